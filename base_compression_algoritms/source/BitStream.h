@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// buffered bit writer and reader shared by the codecs. Word is the accumulator,
+// it is stored and loaded whole, so both sides touch memory once per word
+// instead of once per field. Lsb streams fill every byte from bit 0 up, Msb
+// streams from bit 7 down, so 4-bit fields of an Msb stream are the high and
+// then the low nibble of each byte. Stores and loads assume a little endian
+// machine.
+namespace bitstream
+{
+
+enum class BitOrder {
+	Lsb,
+	Msb
+};
+
+inline uint32_t byteSwap(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t byteSwap(uint64_t v) { return __builtin_bswap64(v); }
+
+template <BitOrder Order, typename Word = uint64_t>
+struct Writer
+{
+	static constexpr uint32_t WordBits = sizeof(Word) * 8;
+
+	uint8_t *out;
+	Word buffer{0};
+	// pending bits, less than WordBits between flushes
+	uint32_t count{0};
+
+	// up to 32 bits at a time, the bits above length have to be 0
+	void put(uint32_t bits, uint32_t length) {
+		if(Order == BitOrder::Lsb) {
+			buffer |= Word(bits) << count;
+		} else {
+			buffer |= Word(bits) << (WordBits - count - length);
+		}
+		count += length;
+	}
+
+	void flushBytes() {
+		while(count >= 8) {
+			if(Order == BitOrder::Lsb) {
+				*out++ = static_cast<uint8_t>(buffer);
+				buffer >>= 8;
+			} else {
+				*out++ = static_cast<uint8_t>(buffer >> (WordBits - 8));
+				buffer <<= 8;
+			}
+			count -= 8;
+		}
+	}
+
+	// stores a full word, needs sizeof(Word) bytes of room after out
+	void flushWord() {
+		const Word word = Order == BitOrder::Lsb ? buffer : byteSwap(buffer);
+		memcpy(out, &word, sizeof(word));
+		out += count >> 3;
+		if(Order == BitOrder::Lsb) {
+			buffer >>= count & ~7u;
+		} else {
+			buffer <<= count & ~7u;
+		}
+		count &= 7;
+	}
+
+	// the whole bytes and then a last one padded with zeros, byte by byte
+	void finish() {
+		flushBytes();
+		if(count != 0) {
+			*out++ = static_cast<uint8_t>(Order == BitOrder::Lsb ? buffer : buffer >> (WordBits - 8));
+			buffer = 0;
+			count = 0;
+		}
+	}
+};
+
+// keeps up to WordBits bits buffered and never reads outside [p, end). count
+// only goes negative once a corrupted stream reads past its end, then zeros
+// are read.
+template <BitOrder Order, typename Word = uint64_t>
+struct Reader
+{
+	static constexpr uint32_t WordBits = sizeof(Word) * 8;
+
+	const uint8_t *p;
+	const uint8_t *end;
+	Word buffer{0};
+	int32_t count{0};
+
+	// at least WordBits - 8 bits are buffered afterwards unless the end is near
+	void refill() {
+		if(end - p >= static_cast<ptrdiff_t>(sizeof(Word))) {
+			Word word;
+			memcpy(&word, p, sizeof(word));
+			if(Order == BitOrder::Lsb) {
+				buffer |= word << count;
+			} else {
+				buffer |= byteSwap(word) >> count;
+			}
+			p += (WordBits - 1 - count) >> 3;
+			count |= WordBits - 8;
+			return;
+		}
+		while(count <= static_cast<int32_t>(WordBits - 8) && p < end) {
+			if(Order == BitOrder::Lsb) {
+				buffer |= Word(*p++) << count;
+			} else {
+				buffer |= Word(*p++) << (WordBits - 8 - count);
+			}
+			count += 8;
+		}
+	}
+
+	// n is at most 32 and below WordBits
+	uint32_t peek(uint32_t n) const {
+		if(Order == BitOrder::Lsb) return static_cast<uint32_t>(buffer & ((Word(1) << n) - 1));
+		return static_cast<uint32_t>((buffer >> 1) >> (WordBits - 1 - n));
+	}
+
+	void consume(uint32_t n) {
+		if(Order == BitOrder::Lsb) {
+			buffer >>= n;
+		} else {
+			buffer <<= n;
+		}
+		count -= static_cast<int32_t>(n);
+	}
+
+	// the caller refills so that n bits are buffered
+	uint32_t read(uint32_t n) {
+		const uint32_t value = peek(n);
+		consume(n);
+		return value;
+	}
+
+	// bits not read yet, the padding of the last byte included
+	int64_t bitsLeft() const { return int64_t(end - p) * 8 + count; }
+};
+
+}
@@ -1,4 +1,51 @@
 #include "Compressor.h"
+#include "Dictionary.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+const size_t FrameHeaderSize = sizeof(uint32_t) * 2;
+const size_t FileHeaderSize = sizeof(uint64_t);
+
+// empty files have no mapping, the codecs still want a buffer
+uint8_t empty_buffer[1];
+
+// items a batch worker takes at once, small ones are not worth a task each
+const size_t BatchChunk = 16;
+
+// frames start wherever the caller's buffer puts them
+inline uint32_t read32(const uint8_t *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+inline void write32(uint8_t *p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+inline uint64_t read64(const uint8_t *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+inline void write64(uint8_t *p, uint64_t v) { memcpy(p, &v, sizeof(v)); }
+
+}
+
+void CompressorStats::addNested(const CompressorStats &nested) {
+	header_bytes += nested.header_bytes;
+	literals += nested.literals;
+	matches += nested.matches;
+	match_length_sum += nested.match_length_sum;
+	match_offset_sum += nested.match_offset_sum;
+	match_probes += nested.match_probes;
+	dict_hits += nested.dict_hits;
+	dict_collisions += nested.dict_collisions;
+	coded_symbols += nested.coded_symbols;
+	code_bits += nested.code_bits;
+	stored_blocks += nested.stored_blocks;
+}
+
+void CompressorStats::add(const CompressorStats &other) {
+	calls += other.calls;
+	bytes_in += other.bytes_in;
+	bytes_out += other.bytes_out;
+	addNested(other);
+}
 
 Compressor::Compressor() {
 }
@@ -6,6 +53,15 @@ Compressor::Compressor() {
 Compressor::~Compressor() {
 }
 
+bool Compressor::setDictionary(std::shared_ptr<const Dictionary> dictionary) {
+	if(!onSetDictionary(dictionary.get())) return false;
+
+	this->dictionary = std::move(dictionary);
+	// the batch clones are made again with it
+	batch_workers.clear();
+	return true;
+}
+
 bool Compressor::compress(const uint8_t *data, size_t data_size,
 	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
 {
@@ -15,7 +71,25 @@ bool Compressor::compress(const uint8_t *data, size_t data_size,
 		return false;
 	}
 
-	return onCompress(data, data_size, out_data, out_data_size, compressed_size);
+	const size_t id_size = dictionaryIdSize();
+	if(out_data_size < id_size) return false;
+	if(dictionary) {
+		const uint32_t id = dictionary->getId();
+		memcpy(out_data, &id, sizeof(id));
+	}
+
+	scratch.reset();
+	if(!onCompress(data, data_size, out_data + id_size, out_data_size - id_size,
+		compressed_size)) return false;
+	compressed_size += id_size;
+
+	if(stats) {
+		stats->calls++;
+		stats->bytes_in += data_size;
+		stats->bytes_out += compressed_size;
+		stats->header_bytes += id_size;
+	}
+	return true;
 }
 
 bool Compressor::decompress(const uint8_t *compressed_data, size_t compressed_data_size,
@@ -25,8 +99,253 @@ bool Compressor::decompress(const uint8_t *compressed_data, size_t compressed_da
 	if (!data || !compressed_data) {
 		return false;
 	}
-	
-	return onDecompress(compressed_data, compressed_data_size, data, data_size,
+
+	// data of another dictionary decodes to garbage, it is refused instead
+	const size_t id_size = dictionaryIdSize();
+	if(compressed_data_size < id_size) return false;
+	if(dictionary) {
+		uint32_t id;
+		memcpy(&id, compressed_data, sizeof(id));
+		if(id != dictionary->getId()) return false;
+	}
+
+	scratch.reset();
+	return onDecompress(compressed_data + id_size, compressed_data_size - id_size, data, data_size,
 		decompressed_size);
 }
 
+bool Compressor::compressBatch(CompressorBatchItem *items, size_t count, ThreadPool *pool) {
+	return runBatch(items, count, pool, true);
+}
+
+bool Compressor::decompressBatch(CompressorBatchItem *items, size_t count, ThreadPool *pool) {
+	return runBatch(items, count, pool, false);
+}
+
+Compressor &Compressor::batchWorker(size_t worker) {
+	if(worker == 0) return *this;
+
+	std::unique_ptr<Compressor> &instance = batch_workers[worker];
+	if(!instance) {
+		instance = clone();
+		instance->setDictionary(dictionary);
+	}
+	return *instance;
+}
+
+bool Compressor::runBatch(CompressorBatchItem *items, size_t count, ThreadPool *pool,
+	bool compressing)
+{
+	if(!items && count != 0) return false;
+
+	auto run = [compressing](Compressor &codec, CompressorBatchItem *begin, size_t size) {
+		for(CompressorBatchItem *item = begin; item < begin + size; ++item) {
+			item->ok = compressing
+				? codec.compress(item->data, item->data_size, item->out_data, item->out_data_size,
+					item->result_size)
+				: codec.decompress(item->data, item->data_size, item->out_data,
+					item->out_data_size, item->result_size);
+		}
+	};
+
+	const size_t num_chunks = (count + BatchChunk - 1) / BatchChunk;
+	if(!pool || pool->size() == 1 || num_chunks < 2) {
+		run(*this, items, count);
+	} else {
+		// every worker counts into its own stats, this one included
+		CompressorStats *saved_stats = stats;
+		batch_workers.resize(std::max(batch_workers.size(), pool->size()));
+		batch_stats.assign(pool->size(), CompressorStats());
+		for(size_t worker = 0; worker < pool->size(); ++worker) {
+			batchWorker(worker).stats = saved_stats ? &batch_stats[worker] : nullptr;
+		}
+
+		pool->parallelFor(num_chunks, [&](size_t chunk, size_t worker) {
+			const size_t begin = chunk * BatchChunk;
+			run(batchWorker(worker), items + begin, std::min(BatchChunk, count - begin));
+		});
+
+		stats = saved_stats;
+		if(stats) {
+			for(const CompressorStats &worker : batch_stats) stats->add(worker);
+		}
+	}
+
+	return std::all_of(items, items + count,
+		[](const CompressorBatchItem &item) { return item.ok; });
+}
+
+bool Compressor::compressFile(const char *path, const char *out_path) {
+	MappedFile in;
+	if(!in.openRead(path)) return false;
+
+	// the output is sized for the worst case, the pages past the end are never touched
+	const size_t capacity = FileHeaderSize + compressBound(in.size());
+	MappedFile out;
+	if(!out.openWrite(out_path, capacity)) return false;
+
+	const uint8_t *data = in.size() > 0 ? in.data() : empty_buffer;
+	size_t compressed_size;
+	bool ok = compress(data, in.size(), out.writableData() + FileHeaderSize,
+		capacity - FileHeaderSize, compressed_size);
+	if(ok) write64(out.writableData(), in.size());
+
+	return out.close(ok ? FileHeaderSize + compressed_size : 0) && ok;
+}
+
+bool Compressor::decompressFile(const char *path, const char *out_path) {
+	MappedFile in;
+	if(!in.openRead(path) || in.size() < FileHeaderSize) return false;
+
+	const uint64_t data_size = read64(in.data());
+
+	MappedFile out;
+	if(!out.openWrite(out_path, data_size)) return false;
+
+	uint8_t *data = data_size > 0 ? out.writableData() : empty_buffer;
+	size_t decompressed_size;
+	bool ok = decompress(in.data() + FileHeaderSize, in.size() - FileHeaderSize, data, data_size,
+		decompressed_size) && decompressed_size == data_size;
+
+	return out.close(ok ? data_size : 0) && ok;
+}
+
+bool Compressor::beginCompress(const WriteCallback &write) {
+	if(compress_stream.active || !write) return false;
+
+	compress_stream.write = write;
+	compress_stream.in.clear();
+	compress_stream.in.reserve(streamBlockSize());
+	compress_stream.active = true;
+	return true;
+}
+
+bool Compressor::feedCompress(const uint8_t *data, size_t data_size) {
+	Stream &s = compress_stream;
+	if(!s.active || (!data && data_size != 0)) return false;
+
+	const size_t block_size = streamBlockSize();
+	const uint8_t *end = data + data_size;
+	while(data < end) {
+		size_t left = end - data;
+
+		// whole blocks go straight from the caller memory
+		if(s.in.empty() && left >= block_size) {
+			if(!compressBlock(data, block_size)) return false;
+			data += block_size;
+			continue;
+		}
+
+		size_t take = std::min(block_size - s.in.size(), left);
+		s.in.insert(s.in.end(), data, data + take);
+		data += take;
+
+		if(s.in.size() == block_size) {
+			if(!compressBlock(s.in.data(), s.in.size())) return false;
+			s.in.clear();
+		}
+	}
+	return true;
+}
+
+bool Compressor::flushCompress() {
+	Stream &s = compress_stream;
+	if(!s.active) return false;
+	if(s.in.empty()) return true;
+
+	bool ok = compressBlock(s.in.data(), s.in.size());
+	s.in.clear();
+	return ok;
+}
+
+bool Compressor::endCompress() {
+	bool ok = flushCompress();
+	compress_stream = Stream();
+	return ok;
+}
+
+bool Compressor::beginDecompress(const WriteCallback &write) {
+	if(decompress_stream.active || !write) return false;
+
+	decompress_stream.write = write;
+	decompress_stream.in.clear();
+	decompress_stream.active = true;
+	return true;
+}
+
+bool Compressor::feedDecompress(const uint8_t *compressed_data, size_t compressed_data_size) {
+	Stream &s = decompress_stream;
+	if(!s.active || (!compressed_data && compressed_data_size != 0)) return false;
+
+	auto frame_size = [](const uint8_t *header) {
+		return FrameHeaderSize + read32(header + sizeof(uint32_t));
+	};
+
+	const size_t max_frame_size = FrameHeaderSize + compressBound(streamBlockSize());
+
+	const uint8_t *p = compressed_data;
+	const uint8_t *end = compressed_data + compressed_data_size;
+	while(p < end) {
+		size_t left = end - p;
+		if(left >= FrameHeaderSize && s.in.empty() && frame_size(p) > max_frame_size) return false;
+
+		// whole frames are decoded in place
+		if(s.in.empty() && left >= FrameHeaderSize && left >= frame_size(p)) {
+			size_t size = frame_size(p);
+			if(!decompressBlock(p, size)) return false;
+			p += size;
+			continue;
+		}
+
+		size_t need = s.in.size() < FrameHeaderSize ? FrameHeaderSize : frame_size(s.in.data());
+		if(need > max_frame_size) return false;
+		size_t take = std::min(need - s.in.size(), left);
+		s.in.insert(s.in.end(), p, p + take);
+		p += take;
+
+		if(s.in.size() >= FrameHeaderSize && s.in.size() == frame_size(s.in.data())) {
+			if(!decompressBlock(s.in.data(), s.in.size())) return false;
+			s.in.clear();
+		}
+	}
+	return true;
+}
+
+bool Compressor::endDecompress() {
+	// a truncated frame left in the buffer means the stream was cut
+	bool ok = decompress_stream.active && decompress_stream.in.empty();
+	decompress_stream = Stream();
+	return ok;
+}
+
+bool Compressor::compressBlock(const uint8_t *data, size_t data_size) {
+	Stream &s = compress_stream;
+	const size_t scratch_size = compressBound(data_size);
+	s.out.resize(FrameHeaderSize + scratch_size);
+
+	size_t compressed_size;
+	if(!compress(data, data_size, s.out.data() + FrameHeaderSize, scratch_size, compressed_size)) {
+		return false;
+	}
+
+	write32(s.out.data(), static_cast<uint32_t>(data_size));
+	write32(s.out.data() + sizeof(uint32_t), static_cast<uint32_t>(compressed_size));
+
+	return s.write(s.out.data(), FrameHeaderSize + compressed_size);
+}
+
+bool Compressor::decompressBlock(const uint8_t *frame, size_t frame_size) {
+	Stream &s = decompress_stream;
+	size_t data_size = read32(frame);
+	if(data_size == 0 || data_size > streamBlockSize()) return false;
+
+	s.out.resize(data_size);
+
+	size_t decompressed_size;
+	if(!decompress(frame + FrameHeaderSize, frame_size - FrameHeaderSize,
+		s.out.data(), data_size, decompressed_size) || decompressed_size != data_size) {
+		return false;
+	}
+
+	return s.write(s.out.data(), decompressed_size);
+}
@@ -1,23 +1,170 @@
 #pragma once
+#include "ScratchArena.h"
+
 #include <cstdint>
 #include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// what compress calls did, summed over the calls made while it is set.
+// Codecs only fill the fields that apply to them.
+struct CompressorStats {
+	size_t calls{0};
+	size_t bytes_in{0};
+	size_t bytes_out{0};
+	// tables and sizes in front of the payload
+	size_t header_bytes{0};
+
+	// LZ77 and LZ78 tokens
+	size_t literals{0};
+	size_t matches{0};
+	size_t match_length_sum{0};
+	size_t match_offset_sum{0};
+	// hash chain candidates compared by the LZ77 match finder
+	size_t match_probes{0};
+
+	// LZ78 dictionary lookups that extended a phrase, and slots probed past
+	// that held another phrase
+	size_t dict_hits{0};
+	size_t dict_collisions{0};
+
+	// Huffman and FSE coded symbols and the bits of their codes
+	size_t coded_symbols{0};
+	size_t code_bits{0};
 
+	// CompressorAuto and CompressorFSE blocks kept as they were
+	size_t stored_blocks{0};
+
+	double averageMatchLength() const { return matches ? double(match_length_sum) / matches : 0; }
+	double averageMatchOffset() const { return matches ? double(match_offset_sum) / matches : 0; }
+	double probesPerByte() const { return bytes_in ? double(match_probes) / bytes_in : 0; }
+	double averageCodeLength() const {
+		return coded_symbols ? double(code_bits) / coded_symbols : 0;
+	}
+
+	// adds what a codec nested in another one counted, its calls and bytes are
+	// part of the outer call
+	void addNested(const CompressorStats &nested);
+
+	// adds everything, for calls counted apart like the workers of a batch
+	void add(const CompressorStats &other);
+};
+
+// one buffer of a batch call, data is the compressed input when decompressing.
+// The result fields are set by the call.
+struct CompressorBatchItem {
+	const uint8_t *data{nullptr};
+	size_t data_size{0};
+	uint8_t *out_data{nullptr};
+	size_t out_data_size{0};
+
+	size_t result_size{0};
+	bool ok{false};
+};
+
+class Dictionary;
+class ThreadPool;
+
+// an instance is the context of its calls: the tables and scratch memory it
+// keeps are reused by the next call, use one instance per thread
 class Compressor {
 public:
+	using WriteCallback = std::function<bool(const uint8_t *data, size_t size)>;
+
 	Compressor();
 	virtual ~Compressor();
 
 	virtual const char *getTypeName() const = 0;
 
+	// a compressor with the same settings, for use on another thread
+	virtual std::unique_ptr<Compressor> clone() const = 0;
+
+	// worst case compressed size of data_size bytes. Output buffers of this size
+	// take the unchecked fast paths, smaller ones are checked near their end.
+	virtual size_t compressBound(size_t data_size) const = 0;
+
+	// compress calls add to stats while it is set, nullptr turns that off
+	void setStats(CompressorStats *stats) { this->stats = stats; }
+	CompressorStats *getStats() const { return stats; }
+
+	// codecs that support it start every message from the dictionary, the
+	// compressed data then begins with its uint32 id and only decompresses with
+	// the same dictionary. False when the codec can not use one, nullptr
+	// goes back to no dictionary.
+	bool setDictionary(std::shared_ptr<const Dictionary> dictionary);
+	const Dictionary *getDictionary() const { return dictionary.get(); }
+
 	bool compress(const uint8_t *data, size_t data_size,
 		uint8_t *out_data, size_t out_data_size, size_t &compressed_size);
 	bool decompress(const uint8_t *compressed_data, size_t compressed_data_size,
 		uint8_t *data, size_t data_size, size_t &decompressed_size);
 
+	// compress or decompress every item like a call of its own would, the
+	// output is the same. One instance runs the items back to back with its
+	// tables and scratch kept warm, with a pool the items are spread over its
+	// workers, which use clones of this instance. True when every item is ok.
+	bool compressBatch(CompressorBatchItem *items, size_t count, ThreadPool *pool = nullptr);
+	bool decompressBatch(CompressorBatchItem *items, size_t count, ThreadPool *pool = nullptr);
+
+	// file to file through memory maps, the input is compressed straight into the
+	// mapped output. Files are [uint64 size][compressed data].
+	bool compressFile(const char *path, const char *out_path);
+	bool decompressFile(const char *path, const char *out_path);
+
+	// streaming: input is cut into independent blocks of streamBlockSize() bytes,
+	// every block is written as [uint32 size][uint32 compressed size][payload]
+	bool beginCompress(const WriteCallback &write);
+	bool feedCompress(const uint8_t *data, size_t data_size);
+	bool flushCompress();
+	bool endCompress();
+
+	bool beginDecompress(const WriteCallback &write);
+	bool feedDecompress(const uint8_t *compressed_data, size_t compressed_data_size);
+	bool endDecompress();
+
 protected:
 	virtual bool onCompress(const uint8_t *data, size_t data_size,
 		uint8_t *out_data, size_t out_data_size, size_t &compressed_size) = 0;
 	virtual bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
 		uint8_t *data, size_t data_size, size_t &decompressed_size) = 0;
 
+	// stream memory is bounded by this, override to match the algorithm state
+	virtual size_t streamBlockSize() const { return 1 << 16; }
+
+	// the codec prepares its tables for a dictionary once, nullptr drops it.
+	// The default is to support none.
+	virtual bool onSetDictionary(const Dictionary *dictionary) { return dictionary == nullptr; }
+
+	// the dictionary id in front of the payload, for compressBound
+	size_t dictionaryIdSize() const { return dictionary ? sizeof(uint32_t) : 0; }
+
+	// memory for the current onCompress or onDecompress call only
+	ScratchArena scratch;
+
+	// nullptr unless the caller asked for statistics
+	CompressorStats *stats{nullptr};
+
+	std::shared_ptr<const Dictionary> dictionary;
+
+private:
+	struct Stream {
+		WriteCallback write;
+		std::vector<uint8_t> in;
+		std::vector<uint8_t> out;
+		bool active{false};
+	};
+
+	bool compressBlock(const uint8_t *data, size_t data_size);
+	bool decompressBlock(const uint8_t *frame, size_t frame_size);
+
+	bool runBatch(CompressorBatchItem *items, size_t count, ThreadPool *pool, bool compressing);
+	// worker 0 is this instance
+	Compressor &batchWorker(size_t worker);
+
+	Stream compress_stream;
+	Stream decompress_stream;
+
+	std::vector<std::unique_ptr<Compressor>> batch_workers;
+	std::vector<CompressorStats> batch_stats;
 };
@@ -0,0 +1,174 @@
+#include "CompressorAuto.h"
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+// block: [uint8 method][uint32 size][uint32 compressed size][payload]
+const size_t BlockHeaderSize = sizeof(uint8_t) + sizeof(uint32_t) * 2;
+
+// the samples are windows of SampleSize bytes spread evenly over the block
+const size_t SampleSize = 1 << 10;
+const size_t NumSamples = 8;
+const uint32_t SampleHashBits = 12;
+const uint32_t MinSampleHashBits = 8;
+
+// below this share of positions that repeat 4 earlier bytes LZ77 has little to do
+const double RareMatches = 0.05;
+// bits per byte above which Huffman codes save next to nothing
+const double FlatEntropy = 7.5;
+
+inline uint32_t read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+}
+
+CompressorAuto::CompressorAuto(int level)
+	: level(level), huffman(4), lz77_huffman(level) {
+}
+
+size_t CompressorAuto::compressBound(size_t data_size) const {
+	// a block is never stored larger than it is
+	return data_size + (data_size + BlockSize - 1) / BlockSize * BlockHeaderSize;
+}
+
+CompressorAuto::Method CompressorAuto::chooseMethod(const uint8_t *data, size_t data_size) {
+	size_t counters[256];
+	memset(counters, 0, sizeof(counters));
+
+	// small blocks are looked at whole, the samples of larger ones do not overlap
+	const bool whole = data_size <= NumSamples * SampleSize;
+	const size_t num_samples = whole ? 1 : NumSamples;
+
+	// positions + 1 of the last 4 bytes with a hash, across the samples. Small
+	// blocks only clear and use the front of the table.
+	uint32_t hash_bits = MinSampleHashBits;
+	while(hash_bits < SampleHashBits && (size_t(1) << hash_bits) < data_size) ++hash_bits;
+	uint32_t table[1 << SampleHashBits];
+	memset(table, 0, sizeof(uint32_t) << hash_bits);
+
+	const size_t stride = whole ? 0 : (data_size - SampleSize) / (NumSamples - 1);
+	size_t sampled = 0;
+	size_t matches = 0;
+	for(size_t s = 0; s < num_samples; ++s) {
+		const size_t begin = s * stride;
+		const size_t end = whole ? data_size : begin + SampleSize;
+		simd::histogram(data + begin, end - begin, counters);
+		sampled += end - begin;
+
+		for(size_t pos = begin; pos + sizeof(uint32_t) <= end; ++pos) {
+			const uint32_t v = read32(data + pos);
+			uint32_t &candidate = table[(v * 2654435761u) >> (32 - hash_bits)];
+			if(candidate != 0 && read32(data + candidate - 1) == v) ++matches;
+			candidate = static_cast<uint32_t>(pos + 1);
+		}
+	}
+	if(sampled == 0) return Method::Stored;
+
+	if(matches >= sampled * RareMatches) return Method::LZ77Huffman;
+
+	double entropy = 0;
+	for(size_t count : counters) {
+		if(count == 0) continue;
+		const double p = double(count) / sampled;
+		entropy -= p * std::log2(p);
+	}
+	return entropy > FlatEntropy ? Method::Stored : Method::Huffman;
+}
+
+Compressor *CompressorAuto::compressor(Method method) {
+	switch(method) {
+	case Method::Huffman: return &huffman;
+	case Method::LZ77Huffman: return &lz77_huffman;
+	default: return nullptr;
+	}
+}
+
+bool CompressorAuto::onCompress(const uint8_t *data, size_t data_size,
+	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
+{
+	// the children count into a local so that a failed call adds nothing
+	CompressorStats block_stats;
+	huffman.setStats(stats ? &block_stats : nullptr);
+	lz77_huffman.setStats(stats ? &block_stats : nullptr);
+
+	uint8_t *out = out_data;
+	uint8_t *out_end = out_data + out_data_size;
+	for(size_t offset = 0; offset < data_size; offset += BlockSize) {
+		const uint8_t *block = data + offset;
+		const uint32_t size = static_cast<uint32_t>(std::min(BlockSize, data_size - offset));
+		if(static_cast<size_t>(out_end - out) < BlockHeaderSize) return false;
+
+		uint8_t *payload = out + BlockHeaderSize;
+		const size_t room = out_end - payload;
+
+		// a coded block has to come out smaller than the stored one
+		Method method = chooseMethod(block, size);
+		size_t payload_size = 0;
+		if(method != Method::Stored && !compressor(method)->compress(block, size, payload,
+			std::min<size_t>(room, size - 1), payload_size)) {
+			method = Method::Stored;
+		}
+		if(method == Method::Stored) {
+			if(room < size) return false;
+			memcpy(payload, block, size);
+			payload_size = size;
+			block_stats.stored_blocks++;
+		}
+		block_stats.header_bytes += BlockHeaderSize;
+
+		const uint32_t stored_size = static_cast<uint32_t>(payload_size);
+		out[0] = static_cast<uint8_t>(method);
+		memcpy(out + sizeof(uint8_t), &size, sizeof(size));
+		memcpy(out + sizeof(uint8_t) + sizeof(size), &stored_size, sizeof(stored_size));
+		out = payload + payload_size;
+	}
+
+	compressed_size = out - out_data;
+	if(stats) stats->addNested(block_stats);
+	return true;
+}
+
+bool CompressorAuto::onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+	uint8_t *data, size_t data_size, size_t &decompressed_size)
+{
+	const uint8_t *p = compressed_data;
+	const uint8_t *compressed_data_end = compressed_data + compressed_data_size;
+	uint8_t *out = data;
+	uint8_t *data_end = data + data_size;
+	while(p < compressed_data_end) {
+		if(static_cast<size_t>(compressed_data_end - p) < BlockHeaderSize) return false;
+
+		const Method method = static_cast<Method>(p[0]);
+		uint32_t size;
+		uint32_t payload_size;
+		memcpy(&size, p + sizeof(uint8_t), sizeof(size));
+		memcpy(&payload_size, p + sizeof(uint8_t) + sizeof(size), sizeof(payload_size));
+		p += BlockHeaderSize;
+
+		if(payload_size > static_cast<size_t>(compressed_data_end - p)) return false;
+		if(size > BlockSize || size > static_cast<size_t>(data_end - out)) return false;
+
+		if(method == Method::Stored) {
+			if(payload_size != size) return false;
+			memcpy(out, p, size);
+		} else {
+			Compressor *codec = compressor(method);
+			size_t block_size;
+			if(!codec || !codec->decompress(p, payload_size, out, size, block_size)
+				|| block_size != size) return false;
+		}
+		p += payload_size;
+		out += size;
+	}
+
+	decompressed_size = out - data;
+	return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "Compressor.h"
+#include "CompressorHuffman.h"
+#include "CompressorLZ77Huffman.h"
+
+// picks a codec for every block from a cheap look at samples of it: blocks
+// without repeats and with a flat byte distribution are stored, blocks without
+// repeats are Huffman coded, the others go through LZ77 + Huffman. A block
+// is also stored when its codec does not make it smaller.
+class CompressorAuto : public Compressor {
+
+public:
+	static constexpr size_t BlockSize = 1 << 18;
+
+	enum class Method : uint8_t {
+		Stored,
+		Huffman,
+		LZ77Huffman
+	};
+
+	// level of the LZ77 parse
+	explicit CompressorAuto(int level = CompressorLZ77::DefaultLevel);
+
+	const char *getTypeName() const override { return "CompressorAuto"; }
+
+	std::unique_ptr<Compressor> clone() const override {
+		return std::make_unique<CompressorAuto>(level);
+	}
+
+	size_t compressBound(size_t data_size) const override;
+
+	// the method a block would get, from its samples
+	static Method chooseMethod(const uint8_t *data, size_t data_size);
+
+protected:
+	bool onCompress(const uint8_t *data, size_t data_size,
+		uint8_t *out_data, size_t out_data_size, size_t &compressed_size) override;
+	bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+		uint8_t *data, size_t data_size, size_t &decompressed_size) override;
+
+	size_t streamBlockSize() const override { return BlockSize * 8; }
+
+private:
+	Compressor *compressor(Method method);
+
+	int level;
+	CompressorHuffman huffman;
+	CompressorLZ77Huffman lz77_huffman;
+
+};
@@ -0,0 +1,129 @@
+#include "CompressorFSE.h"
+#include "SimdKernels.h"
+
+#include <memory.h>
+#include <algorithm>
+
+namespace
+{
+
+// [uint8 mode][uint32 size] and then the table and the payload, the symbol
+// of a run, or for stored blocks the data without the size
+enum Mode : uint8_t {
+	Stored = 0,
+	Run = 1,
+	Coded = 2
+};
+
+const size_t HeaderSize = sizeof(uint8_t) + sizeof(uint32_t);
+static_assert(HeaderSize >= fse::NumStates, "coded blocks are larger than the header");
+
+}
+
+CompressorFSE::CompressorFSE(uint32_t table_log)
+	: table_log(std::max(fse::MinTableLog, std::min(table_log, fse::MaxTableLog))) {
+}
+
+size_t CompressorFSE::compressBound(size_t data_size) const {
+	// blocks that do not get smaller are stored
+	return sizeof(uint8_t) + data_size;
+}
+
+bool CompressorFSE::onCompress(const uint8_t *data, size_t data_size,
+	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
+{
+	if(data_size > UINT32_MAX) return false;
+
+	auto store = [&]() {
+		if(out_data_size < sizeof(uint8_t) + data_size) return false;
+		out_data[0] = Mode::Stored;
+		if(data_size != 0) memcpy(out_data + sizeof(uint8_t), data, data_size);
+		compressed_size = sizeof(uint8_t) + data_size;
+		if(stats) {
+			stats->header_bytes += sizeof(uint8_t);
+			stats->stored_blocks++;
+		}
+		return true;
+	};
+
+	// nothing this small gets smaller, and the coder needs a symbol per state
+	if(data_size <= HeaderSize) return store();
+
+	size_t counters[fse::NumSymbols];
+	memset(counters, 0, sizeof(counters));
+	simd::histogram(data, data_size, counters);
+
+	const size_t num_symbols = fse::NumSymbols - std::count(counters, counters + fse::NumSymbols, 0);
+	const uint32_t size = static_cast<uint32_t>(data_size);
+	if(num_symbols <= 1) {
+		if(out_data_size < HeaderSize + 1) return store();
+		out_data[0] = Mode::Run;
+		memcpy(out_data + sizeof(uint8_t), &size, sizeof(size));
+		out_data[HeaderSize] = data[0];
+		compressed_size = HeaderSize + 1;
+		if(stats) stats->header_bytes += HeaderSize;
+		return true;
+	}
+
+	encoder.build(counters, data_size, table_log);
+
+	// coded in place when the largest payload and the slack of word stores
+	// fit, otherwise in scratch memory and only copied when it fits
+	const size_t max_size = HeaderSize + encoder.headerSize()
+		+ (encoder.maxPayloadBits(counters) + 7) / 8 + sizeof(uint64_t);
+	uint8_t *out = out_data_size >= max_size ? out_data : scratch.allocate<uint8_t>(max_size);
+
+	out[0] = Mode::Coded;
+	memcpy(out + sizeof(uint8_t), &size, sizeof(size));
+	uint8_t *payload = encoder.writeHeader(out + HeaderSize);
+	uint8_t *end = encoder.encode(data, data_size, payload);
+
+	// a coded block has to come out smaller than the stored one
+	const size_t coded_size = end - out;
+	if(coded_size >= sizeof(uint8_t) + data_size) return store();
+	if(coded_size > out_data_size) return false;
+	if(out != out_data) memcpy(out_data, out, coded_size);
+
+	compressed_size = coded_size;
+	if(stats) {
+		stats->header_bytes += payload - out;
+		stats->coded_symbols += data_size;
+		stats->code_bits += (end - payload) * 8;
+	}
+	return true;
+}
+
+bool CompressorFSE::onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+	uint8_t *data, size_t data_size, size_t &decompressed_size)
+{
+	if(compressed_data_size < sizeof(uint8_t)) return false;
+
+	const uint8_t *compressed_data_end = compressed_data + compressed_data_size;
+	const uint8_t mode = compressed_data[0];
+	if(mode == Mode::Stored) {
+		const size_t size = compressed_data_size - sizeof(uint8_t);
+		if(size > data_size) return false;
+		if(size != 0) memcpy(data, compressed_data + sizeof(uint8_t), size);
+		decompressed_size = size;
+		return true;
+	}
+
+	if(compressed_data_size < HeaderSize) return false;
+	uint32_t size;
+	memcpy(&size, compressed_data + sizeof(uint8_t), sizeof(size));
+	if(size > data_size) return false;
+	const uint8_t *p = compressed_data + HeaderSize;
+
+	if(mode == Mode::Run) {
+		if(p + 1 != compressed_data_end) return false;
+		memset(data, *p, size);
+	} else if(mode == Mode::Coded) {
+		p = decoder.readHeader(p, compressed_data_end);
+		if(!p || !decoder.decode(p, compressed_data_end, data, size)) return false;
+	} else {
+		return false;
+	}
+
+	decompressed_size = size;
+	return true;
+}
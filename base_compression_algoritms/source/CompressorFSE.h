@@ -0,0 +1,38 @@
+#pragma once
+#include "Compressor.h"
+#include "FSECoder.h"
+
+// one tANS table per block: closer to the entropy than whole-bit Huffman
+// codes when some bytes are much more common than others
+class CompressorFSE : public Compressor {
+
+public:
+	static constexpr uint32_t DefaultTableLog = 11;
+
+	// the table has at most 2^table_log states, small blocks use fewer
+	explicit CompressorFSE(uint32_t table_log = DefaultTableLog);
+
+	const char *getTypeName() const override { return "CompressorFSE"; }
+
+	std::unique_ptr<Compressor> clone() const override {
+		return std::make_unique<CompressorFSE>(table_log);
+	}
+
+	size_t compressBound(size_t data_size) const override;
+
+protected:
+	bool onCompress(const uint8_t *data, size_t data_size,
+		uint8_t *out_data, size_t out_data_size, size_t &compressed_size) override;
+	bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+		uint8_t *data, size_t data_size, size_t &decompressed_size) override;
+
+	// like CompressorHuffman, bigger blocks amortize the table
+	size_t streamBlockSize() const override { return 1 << 17; }
+
+private:
+	uint32_t table_log;
+	// tables, reused by the next call
+	fse::Encoder encoder;
+	fse::Decoder decoder;
+
+};
@@ -1,181 +1,278 @@
 #include "CompressorHuffman.h"
+#include "Dictionary.h"
+#include "HuffmanCoder.h"
+#include "SimdKernels.h"
 
 #include <memory.h>
-#include <vector>
 #include <algorithm>
-#include <iostream>
 
-using CodeType = uint8_t;
-using IndexType = int16_t;
-using std::vector;
-using std::sort;
+using namespace huffman;
 
 namespace
 {
 
+// [uint8 tail bits | (streams - 1) << 3 | StaticCode][code lengths][payload],
+// the static code of the dictionary has no lengths
+const uint8_t StaticCode = 0b10000000;
+
+// the jump table follows the code lengths and is not aligned
+inline uint32_t read32(const uint8_t *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+inline void write32(uint8_t *p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+// the streams are independent chains, decoding them in lockstep lets the cpu
+// overlap the lookups. N fixes the stream count at compile time so the
+// readers stay in registers, 0 takes it from num_streams.
+template <uint8_t N>
+void decodeLockstep(BitReader *readers, uint8_t **outs, size_t rounds,
+	const Decoder &decoder, uint8_t num_streams = N) {
+	const uint8_t streams = N != 0 ? N : num_streams;
+	BitReader local[N != 0 ? N : CompressorHuffman::MaxStreams];
+	uint8_t *out[N != 0 ? N : CompressorHuffman::MaxStreams];
+	for(uint8_t s = 0; s < streams; ++s) {
+		local[s] = readers[s];
+		out[s] = outs[s];
+	}
 
-struct Node
-{
-	CodeType code;
-	uint8_t dir;
-	IndexType left;
-	IndexType right;
-	IndexType parent;
-};
-
-struct Index
-{
-	IndexType node;
-	size_t count;
-};
+	for(size_t r = 0; r + SymbolsPerRefill <= rounds; r += SymbolsPerRefill) {
+		for(uint8_t s = 0; s < streams; ++s) local[s].refill();
 
-}
-
-bool CompressorHuffman::onCompress(const uint8_t *data, size_t data_size,
-	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
-{
-	size_t counters[1 << (sizeof(CodeType) * 8)];
-	memset(counters, 0, sizeof(counters));
-
-	for(size_t i = 0; i < data_size; ++i) {
-		counters[data[i]]++;
+		for(int k = 0; k < SymbolsPerRefill; ++k) {
+			for(uint8_t s = 0; s < streams; ++s) {
+				out[s][k] = decoder.decodeShort(local[s]);
+			}
+		}
+		for(uint8_t s = 0; s < streams; ++s) out[s] += SymbolsPerRefill;
 	}
 
-	vector<Node> nodes;
-	vector<Index> indices;
-	uint8_t char_to_index[1 << (sizeof(CodeType) * 8)];
-
-	// init tree
-	for(size_t i = 0; i < sizeof(counters) / sizeof(size_t); ++i) {
-		size_t count = counters[i];
-		if(count == 0) continue;
-		char_to_index[i] = nodes.size();
-		indices.push_back({static_cast<int16_t>(nodes.size()), count});
-		nodes.push_back({static_cast<uint8_t>(i), 0, -1, -1, -1});
+	for(uint8_t s = 0; s < streams; ++s) {
+		readers[s] = local[s];
+		outs[s] = out[s];
 	}
+}
 
-	// sort by count
-	sort(indices.begin(), indices.end(),
-		[](const auto &i0, const auto &i1){ return i0.count > i1.count; });
+}
+
+CompressorHuffman::CompressorHuffman(uint8_t num_streams)
+	: num_streams(std::max<uint8_t>(1, std::min(num_streams, MaxStreams))) {
+}
 
-	// build tree
-	while(indices.size() > 1) {
-		auto i0 = indices.back();
-		indices.pop_back();
+size_t CompressorHuffman::compressBound(size_t data_size) const {
+	// tail byte, stream jumps and byte padding, and the slack of word stores
+	return dictionaryIdSize() + sizeof(uint8_t) + maxCodedSize(data_size)
+		+ (sizeof(uint32_t) + 1) * MaxStreams + sizeof(uint64_t);
+}
 
-		auto i1 = indices.back();
-		indices.pop_back();
+bool CompressorHuffman::onSetDictionary(const Dictionary *dictionary) {
+	if(!dictionary) return true;
+	// the static code is used for any data, a symbol without a code would be lost
+	const uint8_t *lengths = dictionary->getCodeLengths();
+	if(std::count(lengths, lengths + NumSymbols, 0) != 0) return false;
+	return static_encoder.buildFromLengths(lengths) && static_decoder.build(lengths);
+}
 
-		Node &n0 = nodes[i0.node];
-		n0.dir = 1;
-		n0.parent = nodes.size();
+bool CompressorHuffman::onCompress(const uint8_t *data, size_t data_size,
+	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
+{
+	size_t counters[NumSymbols];
+	memset(counters, 0, sizeof(counters));
 
-		Node &n1 = nodes[i1.node];
-		n1.dir = 0;
-		n1.parent = nodes.size();
+	simd::histogram(data, data_size, counters);
 
-		indices.push_back({static_cast<int16_t>(nodes.size()), i0.count + i1.count});
+	Encoder encoder;
+	encoder.build(counters);
 
-		nodes.push_back({'\0', 0, i1.node, i0.node, -1});
+	size_t payload_bits = encoder.payloadBits(counters);
+	size_t lengths_size = encoder.headerSize();
 
-		sort(indices.begin(), indices.end(),
-			[](const auto &i0, const auto &i1){ return i0.count > i1.count; });
+	// the static code wins when it saves more than the lengths cost
+	bool static_code = false;
+	if(dictionary) {
+		const size_t static_bits = static_encoder.payloadBits(counters);
+		if((static_bits + 7) / 8 <= lengths_size + (payload_bits + 7) / 8) {
+			static_code = true;
+			payload_bits = static_bits;
+			lengths_size = 0;
+		}
 	}
+	const Code *codes = static_code ? static_encoder.codes() : encoder.codes();
+
+	const size_t header_size = sizeof(uint8_t) + lengths_size;
+	if(out_data_size < header_size + (payload_bits + 7) / 8) return false;
 
 	uint8_t *out_header = out_data;
 	uint8_t tail = 0;
 	out_header += sizeof(tail); //reserve space for tail
 
-	// write num nodes
-	*reinterpret_cast<uint16_t *>(out_header) = nodes.size();
-	out_header += sizeof(uint16_t);
-
-	// write tree
-	for(const Node &n : nodes) {
-		*out_header++ = n.code;
-		*reinterpret_cast<int16_t *>(out_header) = n.left;
-		out_header += sizeof(int16_t);
-		*reinterpret_cast<int16_t *>(out_header) = n.right;
-		out_header += sizeof(int16_t);
-	}
-
-	uint8_t *out = out_header;
-	*out = 0;
-
-	uint8_t index_bit = 0;
-	uint8_t path[sizeof(uint32_t) * 8];
-
-	for(size_t i = 0; i < data_size; ++i) {
-		uint8_t c = data[i];
-		IndexType node_index = char_to_index[c];
-		uint8_t *p = path - 1;
-		while(node_index != -1) {
-			const Node &node = nodes[node_index];
-			*++p = node.dir;
-			node_index = node.parent;
+	// write code lengths
+	if(!static_code) out_header = encoder.writeHeader(out_header);
+	const uint8_t code_flag = static_code ? StaticCode : 0;
+
+	// multi stream mode is limited by the 32-bit jump table
+	const uint8_t streams = data_size <= UINT32_MAX && data_size != 0 ? num_streams : 1;
+	if(streams > 1) {
+		const size_t jump_size = sizeof(uint32_t) * streams;
+		// every stream is padded to a byte
+		const size_t max_size = header_size + jump_size + (payload_bits + 7) / 8 + streams;
+		const size_t segment = (data_size + streams - 1) / streams;
+		if(out_data_size < max_size) {
+			// only the exact padded sizes of the streams tell whether they fit
+			size_t size = header_size + jump_size;
+			for(uint8_t s = 0; s < streams; ++s) {
+				size_t begin = std::min(s * segment, data_size);
+				size_t end = std::min(begin + segment, data_size);
+				size_t bits = 0;
+				for(size_t i = begin; i < end; ++i) bits += codes[data[i]].length;
+				size += (bits + 7) / 8;
+			}
+			if(out_data_size < size) return false;
 		}
+		const bool checked = out_data_size < max_size + sizeof(uint64_t);
+
+		// data size followed by the sizes of all streams but the last
+		write32(out_header, static_cast<uint32_t>(data_size));
+		uint8_t *jump = out_header + sizeof(uint32_t);
+
+		uint8_t *out = out_header + jump_size;
+		for(uint8_t s = 0; s < streams; ++s) {
+			size_t begin = std::min(s * segment, data_size);
+			size_t end = std::min(begin + segment, data_size);
+
+			BitWriter writer{out};
+			if(checked) {
+				writer.encode<true>(codes, data + begin, end - begin);
+			} else {
+				writer.encode<false>(codes, data + begin, end - begin);
+			}
+			writer.finish();
 
-		if(p == path) p++;
+			if(s + 1 < streams) write32(jump + s * sizeof(uint32_t), static_cast<uint32_t>(writer.out - out));
+			out = writer.out;
+		}
 
-		while(p > path) {
-			*out |= (*--p << index_bit);
-			index_bit = (index_bit + 1) & (sizeof(uint8_t) * 8 - 1);
-			if(index_bit == 0) {
-				if((out - out_data) >= out_data_size) return false;
-				*++out = 0;
-			}
+		compressed_size = out - out_data;
+		*out_data = ((streams - 1) << 3) | code_flag;
+		if(stats) {
+			stats->header_bytes += header_size + jump_size;
+			stats->coded_symbols += data_size;
+			stats->code_bits += payload_bits;
 		}
+		return true;
 	}
 
-	compressed_size = out - out_data;
-	tail = index_bit;
-	if(tail != 0) ++compressed_size;
+	// whole words are stored when there is slack after the payload
+	BitWriter writer{out_header};
+	if(out_data_size >= header_size + (payload_bits + 7) / 8 + sizeof(uint64_t)) {
+		writer.encode<false>(codes, data, data_size);
+	} else {
+		writer.encode<true>(codes, data, data_size);
+	}
 
-	*out_data = tail;
+	uint8_t *out = writer.out;
+	tail = writer.count;
+	if(tail != 0) *out++ = static_cast<uint8_t>(writer.buffer);
 
-	std::cout << "Header size: " << out_header - out_data  <<std::endl;
-	std::cout << "Tail: " << int(tail)  <<std::endl;
+	compressed_size = out - out_data;
+	*out_data = tail | code_flag;
+	if(stats) {
+		stats->header_bytes += header_size;
+		stats->coded_symbols += data_size;
+		stats->code_bits += payload_bits;
+	}
 	return true;
 }
 
 bool CompressorHuffman::onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
 	uint8_t *data, size_t data_size, size_t &decompressed_size)
 {
-	const uint8_t *header = compressed_data;
-	uint8_t tail = *header++;
+	if(compressed_data_size < sizeof(uint8_t)) return false;
 
-	uint16_t num_nodes = *reinterpret_cast<const uint16_t *>(header);
-	header += sizeof(uint16_t);
+	const uint8_t *header = compressed_data;
+	const uint8_t *compressed_data_end = compressed_data + compressed_data_size;
+	uint8_t tail = *header & 0b111;
+	const bool static_code = (*header & StaticCode) != 0;
+	uint8_t streams = ((*header++ >> 3) & 0b1111) + 1;
+	if(static_code && !dictionary) return false;
+
+	// empty input has no lengths
+	if(header == compressed_data_end) return true;
+
+	// read code lengths
+	Decoder dynamic_decoder;
+	if(!static_code) {
+		header = dynamic_decoder.readHeader(header, compressed_data_end);
+		if(!header) return false;
+	}
+	const Decoder &decoder = static_code ? static_decoder : dynamic_decoder;
+
+	if(streams > 1) {
+		const size_t jump_size = sizeof(uint32_t) * streams;
+		if(static_cast<size_t>(compressed_data_end - header) < jump_size) return false;
+
+		const size_t total_size = read32(header);
+		const uint8_t *jump = header + sizeof(uint32_t);
+		if(total_size > data_size) return false;
+
+		BitReader readers[MaxStreams];
+		uint8_t *outs[MaxStreams];
+		uint8_t *out_ends[MaxStreams];
+
+		const uint8_t *stream = header + jump_size;
+		const size_t segment = (total_size + streams - 1) / streams;
+		for(uint8_t s = 0; s < streams; ++s) {
+			size_t size = s + 1 < streams ? read32(jump + s * sizeof(uint32_t)) : compressed_data_end - stream;
+			if(size > static_cast<size_t>(compressed_data_end - stream)) return false;
+			readers[s] = BitReader{stream, stream + size};
+			stream += size;
+
+			size_t begin = std::min(s * segment, total_size);
+			outs[s] = data + begin;
+			out_ends[s] = data + std::min(begin + segment, total_size);
+		}
 
-	vector<Node> nodes;
-	nodes.reserve(num_nodes);
-	for(uint16_t i = 0; i < num_nodes; ++i) {
-		Node n;
-		n.code = *header++;
+		// the last segment is the shortest
+		const size_t rounds = out_ends[streams - 1] - outs[streams - 1];
+		if(streams == 4) {
+			decodeLockstep<4>(readers, outs, rounds, decoder);
+		} else {
+			decodeLockstep<0>(readers, outs, rounds, decoder, streams);
+		}
 
-		n.left = *reinterpret_cast<const int16_t *>(header);
-		header += sizeof(int16_t);
-		n.right = *reinterpret_cast<const int16_t *>(header);
-		header += sizeof(int16_t);
+		for(uint8_t s = 0; s < streams; ++s) {
+			while(outs[s] < out_ends[s]) {
+				*outs[s]++ = decoder.decode(readers[s]);
+			}
+		}
 
-		nodes.push_back(n);
+		decompressed_size = total_size;
+		return true;
 	}
 
-	const uint8_t *p = header;
+	int64_t bits_left = (compressed_data_end - header) * 8;
+	if(tail != 0) bits_left -= 8 - tail;
+
+	BitReader reader{header, compressed_data_end};
 	uint8_t *out = data;
-	const Node &root = nodes.back();
-	const Node *current = &root;
-	for(size_t i = header - compressed_data; i < compressed_data_size; ++i) {
-		uint8_t byte = compressed_data[i];
-		for(uint8_t b = 0; b < sizeof(byte) * 8; ++b) {
-			int32_t node_index = (byte & (1 << b)) ? current->right : current->left;
-			current = node_index == -1 ? &root : &nodes[node_index];
-			if(current->left == -1 && current->right == -1) {
-				*out++ = current->code;
-				if((out - data) > data_size) return false;
-				if(tail > 0 && i == (compressed_data_size - 1) && b == (tail - 1)) break;
-				current = &root;
-			}
+	uint8_t *out_end = data + data_size;
+
+	// whole refills while they can not reach the padding or the end of the output
+	const int64_t refill_bits = SymbolsPerRefill * MaxCodeLength;
+	while(bits_left >= refill_bits && out_end - out >= SymbolsPerRefill) {
+		reader.refill();
+		const int32_t count = reader.count;
+		for(int k = 0; k < SymbolsPerRefill; ++k) out[k] = decoder.decodeShort(reader);
+		out += SymbolsPerRefill;
+		bits_left -= count - reader.count;
+	}
+
+	while(bits_left > 0) {
+		reader.refill();
+
+		for(int k = 0; k < SymbolsPerRefill && bits_left > 0; ++k) {
+			if(out == out_end) return false;
+
+			const int32_t count = reader.count;
+			*out++ = decoder.decodeShort(reader);
+			bits_left -= count - reader.count;
 		}
 	}
 
@@ -1,10 +1,25 @@
 #pragma once
 #include "Compressor.h"
+#include "HuffmanCoder.h"
 
 class CompressorHuffman : public Compressor {
 	
 public:
-	const char *getTypeName() const override { return "CompressorHuffman"; };
+	static constexpr uint8_t MaxStreams = 16;
+
+	// num_streams > 1 splits the payload into that many streams sharing one
+	// tree, they are decoded interleaved
+	explicit CompressorHuffman(uint8_t num_streams = 1);
+
+	const char *getTypeName() const override {
+		return num_streams > 1 ? "CompressorHuffmanMultiStream" : "CompressorHuffman";
+	};
+
+	std::unique_ptr<Compressor> clone() const override {
+		return std::make_unique<CompressorHuffman>(num_streams);
+	}
+
+	size_t compressBound(size_t data_size) const override;
 
 protected:
 	bool onCompress(const uint8_t *data, size_t data_size,
@@ -12,4 +27,15 @@ protected:
 	bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
 		uint8_t *data, size_t data_size, size_t &decompressed_size) override;
 
+	// one tree per block, bigger blocks amortize the header
+	size_t streamBlockSize() const override { return 1 << 17; }
+
+	// the static code of the dictionary, used when it beats a tree of its own
+	bool onSetDictionary(const Dictionary *dictionary) override;
+
+private:
+	uint8_t num_streams;
+	huffman::Encoder static_encoder;
+	huffman::Decoder static_decoder;
+
 };
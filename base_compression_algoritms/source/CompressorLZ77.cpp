@@ -1,18 +1,30 @@
 #include "CompressorLZ77.h"
+#include "BitStream.h"
+#include "Dictionary.h"
+#include "LZ77Parser.h"
 #include <cstring>
 #include <stdio.h>
+#include <algorithm>
+#include <vector>
 
 
 namespace {
-using PairType = uint8_t;
-const size_t WindowSize = 255;
+using lz77::PairType;
+using lz77::MinMatch;
+
+// tokens are nibbles, high nibble first
+using NibbleWriter = bitstream::Writer<bitstream::BitOrder::Msb>;
+using NibbleReader = bitstream::Reader<bitstream::BitOrder::Msb>;
 
 enum HeaderFlags : unsigned char {
 	None = 0,
 	Pair = 0b00000001,
 	Dt = 0b00000010,
-	PairFourBit = 0b00000100,
-	DtFourBit = 0b00001000
+	// the pair reuses the offset of the previous one
+	Repeat = 0b00000100,
+	DtFourBit = 0b00001000,
+	// pads the last byte, the encoder never sets Repeat without Pair
+	End = Repeat
 };
 
 struct Node {
@@ -22,82 +34,198 @@ struct Node {
 	uint8_t next;
 };
 
-void find(const uint8_t *window, const uint8_t *data, const uint8_t *data_end, Node &out);
+// wide copies may write this far past the end of a match
+const size_t CopyGuard = 16;
+
+// nibbles of a varint of up to bits bits
+constexpr size_t varintNibbles(size_t bits) { return (bits + 2) / 3; }
+
+// header, length, offset and an 8-bit dt, rounded up to bytes
+const size_t MaxTokenSize = (1 + varintNibbles(sizeof(PairType) * 8)
+	+ varintNibbles(CompressorLZ77::MaxWindowBits) + 2 + 1) / 2;
+
+// the header and a length, then an offset and a dt, take at most 56 bits each:
+// a word flush or a refill between them is enough
+static_assert(4 * (1 + varintNibbles(sizeof(PairType) * 8)) <= 56
+	&& 4 * (varintNibbles(sizeof(PairType) * 8) + 2) <= 56, "a token takes two words");
+
+inline void copy8(uint8_t *dst, const uint8_t *src) {
+	uint64_t v;
+	memcpy(&v, src, sizeof(v));
+	memcpy(dst, &v, sizeof(v));
+}
+
+// copies a match 8 or 16 bytes at a time, the caller leaves CopyGuard bytes after it.
+// Overlapping short offsets are first copied bytewise for a whole period of at least
+// 8 bytes, after that the pattern repeats from that far back and chunks never overlap.
+inline void copyMatchWide(uint8_t *&out, size_t offset, size_t length) {
+	const uint8_t *src = out - offset;
+	uint8_t *dst = out;
+	uint8_t *end = out + length;
+	out = end;
+
+	if(offset < 8) {
+		size_t period = offset * ((8 + offset - 1) / offset);
+		uint8_t *head_end = dst + std::min(period, length);
+		while(dst < head_end) *dst++ = *src++;
+		src = dst - period;
+	} else if(offset >= 16) {
+		while(dst < end) {
+			copy8(dst, src);
+			copy8(dst + 8, src + 8);
+			dst += 16;
+			src += 16;
+		}
+		return;
+	}
+
+	while(dst < end) {
+		copy8(dst, src);
+		dst += 8;
+		src += 8;
+	}
+}
 
+inline uint32_t varintPrice(PairType d) {
+	uint32_t price = 4;
+	while(d >= 0b1000) {
+		price += 4;
+		d >>= 3;
+	}
+	return price;
+}
+
+// bits of the nibble tokens for the optimal parser
+struct NibblePrices {
+	// a header and a literal of about one and a half nibbles
+	uint32_t token() const { return 4 + 6; }
+	uint32_t length(PairType length) const { return varintPrice(length - MinMatch); }
+	uint32_t offset(PairType offset) const { return varintPrice(offset - 1); }
+};
+
+}
+
+CompressorLZ77::CompressorLZ77(int level, uint32_t window_bits)
+	: level(std::max(MinLevel, std::min(level, MaxLevel)))
+	, window_bits(std::max(MinWindowBits, std::min(window_bits, MaxWindowBits))) {
+}
+
+bool CompressorLZ77::onSetDictionary(const Dictionary *dictionary) {
+	if(dictionary) {
+		finder.setDictionary(dictionary->getContent(), dictionary->getContentSize());
+	} else {
+		finder.setDictionary(nullptr, 0);
+	}
+	return true;
 }
 
 bool CompressorLZ77::onCompress(const uint8_t *data, size_t data_size,
 	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
 {
-	uint8_t *out = out_data;
-	bool half_byte_switch{false};
-	auto write_4bit = [&](uint8_t  d) {
-		(half_byte_switch ^= 1) ? *out = d << 4 : *out++ |= (d & 0b00001111);
-	};
+	// the match finder keeps 32-bit positions
+	if(data_size >= UINT32_MAX) return false;
 
-	auto write_8bit = [&](uint8_t d) {
-		write_4bit(d >> 4);
-		write_4bit(d & 0b00001111);
-	};
-	auto write_16bit = [&](uint16_t d) {
-		write_8bit(d >> 8);
-		write_8bit(d & 0b0000000011111111);
-	};
+	uint8_t *out_end = out_data + out_data_size;
+	NibbleWriter writer{out_data};
 
-	Node node;
+	// 3 bits per nibble, the high bit marks that more follow
+	auto write_varint = [&](PairType d) {
+		while(d >= 0b1000) {
+			writer.put(0b1000 | (d & 0b0111), 4);
+			d >>= 3;
+		}
+		writer.put(d, 4);
+	};
 
 	uint8_t last_next = 0;
 	PairType last_offset = 0;
-	PairType last_length = 0;
 
-	const uint8_t *window_start;
-	for(size_t i = 0; i < data_size; ++i) {
-		window_start = i >= WindowSize ? data + (i -  WindowSize) : data;
+	// for the stats, the last token has no literal when its match ends the data
+	size_t pos = 0;
+	size_t literals = 0;
+	size_t matches = 0;
+	size_t match_length_sum = 0;
+	size_t match_offset_sum = 0;
 
-		find(window_start, data + i, data + data_size, node);
-		i += node.length;
+	Node node;
+	auto write_token = [&](const lz77::Token &token) {
+		pos += token.length;
+		literals += pos < data_size;
+		++pos;
+		if(token.length != 0) {
+			++matches;
+			match_length_sum += token.length;
+			match_offset_sum += token.offset;
+		}
 
+		node.offset = token.offset;
+		node.length = token.length;
+		node.next = token.next;
 		node.header = node.next ? HeaderFlags::Dt : HeaderFlags::None;
 
-		if(node.offset != 0 || node.length != 0) {
-			PairType dt = node.offset - last_offset;
-			last_offset = node.offset;
-			node.offset = dt;
-
-			dt = node.length - last_length;
-			last_length = node.length;
-			node.length = dt;
-
+		if(node.length != 0) {
 			node.header |= HeaderFlags::Pair;
-			if(node.offset < 16 && node.length < 16) node.header |= HeaderFlags::PairFourBit;
+			if(node.offset == last_offset) node.header |= HeaderFlags::Repeat;
+			last_offset = node.offset;
 		}
 
 		uint8_t dt = node.next - last_next;
 		last_next = node.next;
 		if(dt < 16) node.header |= HeaderFlags::DtFourBit;
 
-		write_4bit(node.header);
+		writer.put(node.header, 4);
 
 		if((node.header & HeaderFlags::Pair) != 0) {
-			if((node.header & HeaderFlags::PairFourBit) != 0) {
-				write_4bit(node.offset);
-				write_4bit(node.length);
-			} else if(sizeof(PairType) == sizeof(uint8_t)) {
-				write_8bit(node.offset);
-				write_8bit(node.length);
-			} else {
-				write_16bit(node.offset);
-				write_16bit(node.length);
-			}
+			write_varint(node.length - MinMatch);
+			writer.flushWord();
+			if((node.header & HeaderFlags::Repeat) == 0) write_varint(node.offset - 1);
 		}
 
 		if((node.header & HeaderFlags::Dt) != 0) {
-			((node.header & HeaderFlags::DtFourBit) != 0) ? write_4bit(dt) : write_8bit(dt);
+			writer.put(dt, ((node.header & HeaderFlags::DtFourBit) != 0) ? 4 : 8);
+		}
+		writer.flushWord();
+	};
+
+	// tokens are written in place while a whole one and a word store fit, near
+	// the end of the output they go through a buffer and are only copied when
+	// they fit. A pending nibble stays in the writer.
+	const size_t token_room = MaxTokenSize + sizeof(uint64_t);
+	uint8_t token_buffer[token_room];
+	auto write_node = [&](const lz77::Token &token) {
+		if(static_cast<size_t>(out_end - writer.out) >= token_room) {
+			write_token(token);
+			return true;
 		}
+
+		uint8_t *token_out = writer.out;
+		writer.out = token_buffer;
+		write_token(token);
+
+		const size_t size = writer.out - token_buffer;
+		if(size > static_cast<size_t>(out_end - token_out)) return false;
+		memcpy(token_out, token_buffer, size);
+		writer.out = token_out + size;
+		return true;
+	};
+
+	if(!lz77::parse(finder, scratch, data, data_size, level, window_bits, NibblePrices(),
+		write_node)) return false;
+
+	if(writer.count != 0) {
+		if(writer.out == out_end) return false;
+		writer.put(HeaderFlags::End, 4);
+		writer.finish();
 	}
 
-	compressed_size = out - out_data;
-	if(half_byte_switch) ++compressed_size;
+	compressed_size = writer.out - out_data;
+	if(stats) {
+		stats->literals += literals;
+		stats->matches += matches;
+		stats->match_length_sum += match_length_sum;
+		stats->match_offset_sum += match_offset_sum;
+		stats->match_probes += finder.getProbes();
+	}
 
 	return true;
 }
@@ -105,102 +233,74 @@ bool CompressorLZ77::onCompress(const uint8_t *data, size_t data_size,
 bool CompressorLZ77::onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
 	uint8_t *data, size_t data_size, size_t &decompressed_size)
 {
-	const unsigned char *p = compressed_data;
-	const unsigned char *compressed_data_end = compressed_data + compressed_data_size;
-
-	uint8_t read_byte;
-	bool half_byte_switch{false};
-	auto read_4bit = [&]() {
-		return (half_byte_switch ^= 1) ? ((read_byte = *p++) >> 4) : (read_byte & 0b00001111);
-	};
-
-	auto read_8bit = [&]() {
-		uint8_t ret = read_4bit();
-		return (ret << 4) | read_4bit();
-	};
-
-	auto read_16bit = [&]() {
-		uint16_t ret = read_8bit();
-		return (ret << 8) | read_8bit();
+	// reads past the end give zeros, they are caught once the tokens are done
+	NibbleReader reader{compressed_data, compressed_data + compressed_data_size};
+
+	auto read_varint = [&]() {
+		PairType ret = 0;
+		uint32_t d;
+		uint32_t shift = 0;
+		do {
+			d = reader.read(4);
+			ret |= PairType(d & 0b0111) << shift;
+			shift += 3;
+		} while((d & 0b1000) != 0 && shift < sizeof(PairType) * 8);
+		return ret;
 	};
 
 	Node node;
+	const uint8_t *dictionary_data = dictionary ? dictionary->getContent() : nullptr;
+	const size_t dictionary_size = dictionary ? dictionary->getContentSize() : 0;
+
 	uint8_t *out = data;
+	uint8_t *data_end = data + data_size;
 	uint8_t last_next{0};
 	PairType last_offset{0};
-	PairType last_length{0};
-	while(p < compressed_data_end) {
-		node.header = read_4bit();
+	// a token can start in the low half of the last byte
+	while(reader.bitsLeft() > 0) {
+		reader.refill();
+		node.header = static_cast<uint8_t>(reader.read(4));
+		if(node.header == HeaderFlags::End) break;
 		node.offset = node.length = 0;
 		node.next = 0;
 		if((node.header & HeaderFlags::Pair) != 0) {
-			if((node.header & HeaderFlags::PairFourBit) != 0) {
-				node.offset = read_4bit();
-				node.length = read_4bit();
-			} else if(sizeof(PairType) == sizeof(uint8_t)){
-				node.offset = read_8bit();
-				node.length = read_8bit();
-			} else {
-				node.offset = read_16bit();
-				node.length = read_16bit();
-			}
-			node.offset += last_offset;
-			node.length += last_length;
+			node.length = read_varint() + MinMatch;
+			reader.refill();
+			node.offset = (node.header & HeaderFlags::Repeat) != 0 ? last_offset : read_varint() + 1;
 			last_offset = node.offset;
-			last_length = node.length;
 		}
 
 		if((node.header & HeaderFlags::Dt) != 0) {
-			node.next = (((node.header & HeaderFlags::DtFourBit) != 0)
-				? read_4bit() : read_8bit()) + last_next;
+			node.next = static_cast<uint8_t>(reader.read(
+				((node.header & HeaderFlags::DtFourBit) != 0) ? 4 : 8) + last_next);
 		}
 
 		last_next = node.next;
 
 		if(node.length > 0) {
-			uint8_t *p = out - node.offset;
-			PairType length = node.length;
-			while(length-- > 0) *out++ = *p++;
-		  }
+			if(node.offset == 0 || node.offset > static_cast<size_t>(out - data) + dictionary_size) {
+				return false;
+			}
+			if(node.length > static_cast<size_t>(data_end - out)) return false;
+			if(node.offset > static_cast<size_t>(out - data)) {
+				lz77::copyDictionaryMatch(out, data, dictionary_data, dictionary_size,
+					node.offset, node.length);
+			} else if(static_cast<size_t>(data_end - out) >= node.length + CopyGuard) {
+				copyMatchWide(out, node.offset, node.length);
+			} else {
+				const uint8_t *p = out - node.offset;
+				for(PairType length = node.length; length > 0; --length) *out++ = *p++;
+			}
+		}
 
-		if((out - data) >= data_size) break;
+		if(out >= data_end) break;
 
 		*out++ = node.next;
 	}
+	// the last token ran into the padding
+	if(reader.bitsLeft() < 0) return false;
 
 	decompressed_size = out - data;
 	return true;
 }
 
-namespace
-{
-
-void find(const uint8_t *window, const uint8_t *data, const uint8_t *data_end, Node &out) {
-	out.offset = 0;
-	out.length = 0;
-	out.next = *data;
-
-	uint8_t d = *data;
-
-	PairType match_length = 0;
-	PairType match_offset = 0;
-
-	while((data - window) > out.length) {
-		if(*window++ != d) continue;
-		if(data[out.length] != window[out.length - 1]) { window++; continue; }
-
-		match_offset = data - (window - 1);
-		const uint8_t *pd = data + 1;
-		const uint8_t *pw = window;
-		while(pd < data_end && pw < data_end && *pw == *pd) {
-			++pw; ++pd;
-		}
-		if((match_length = (pd - data)) > out.length) {
-			out.offset = match_offset;
-			out.length = match_length;
-			out.next = (data + match_length) < data_end ? data[match_length] : '\0';
-		}
-	}
-}
-
-}
@@ -1,15 +1,53 @@
 #pragma once
 #include "Compressor.h"
+#include "LZ77Parser.h"
+
+#include <algorithm>
 
 class CompressorLZ77 : public Compressor {
 	
 public:
+	static constexpr uint32_t MinWindowBits = 8;
+	static constexpr uint32_t MaxWindowBits = 22;
+
+	// 1-3 greedy with a growing search depth, 4-6 lazy matching,
+	// 7-9 optimal parsing over a cost model of the token format
+	static constexpr int MinLevel = 1;
+	static constexpr int MaxLevel = 9;
+	static constexpr int DefaultLevel = 5;
+
+	// matches reach back up to 2^window_bits - 1 bytes
+	explicit CompressorLZ77(int level = DefaultLevel, uint32_t window_bits = 16);
+
 	const char *getTypeName() const override { return "CompressorLZ77"; }
 
+	std::unique_ptr<Compressor> clone() const override {
+		return std::make_unique<CompressorLZ77>(level, window_bits);
+	}
+
+	// tokens take at most 3 nibbles per byte they cover
+	size_t compressBound(size_t data_size) const override {
+		return dictionaryIdSize() + data_size + data_size / 2 + 2;
+	}
+
 protected:
+	// matches reach into the content of the dictionary
+	bool onSetDictionary(const Dictionary *dictionary) override;
+
 	bool onCompress(const uint8_t *data, size_t data_size,
 		uint8_t *out_data, size_t out_data_size, size_t &compressed_size) override;
 	bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
 		uint8_t *data, size_t data_size, size_t &decompressed_size) override;
 
+	// blocks are independent, each one is a few windows long
+	size_t streamBlockSize() const override {
+		return std::max<size_t>(1 << 18, size_t(4) << window_bits);
+	}
+
+private:
+	int level;
+	uint32_t window_bits;
+	// hash chains, reused by the next call
+	lz77::MatchFinder finder;
+
 };
@@ -0,0 +1,290 @@
+#include "CompressorLZ77Huffman.h"
+#include "Dictionary.h"
+#include "HuffmanCoder.h"
+#include "LZ77Parser.h"
+#include "SimdKernels.h"
+
+#include <cstring>
+
+namespace
+{
+
+using lz77::PairType;
+using lz77::MinMatch;
+
+// [uint32 tokens][uint32 size of the literal, length and offset streams]
+// [literals][lengths][offsets][extra bits].
+// Every token is a length symbol, an offset symbol when it has a match and a
+// literal unless it ends the data. Length symbol 0 means no match, offset
+// symbol 0 repeats the previous offset.
+const size_t NumStreams = 3;
+const size_t HeaderSize = sizeof(uint32_t) * (1 + NumStreams);
+
+// values below 16 are their own symbol, larger ones get a symbol for their top
+// two bits and the bits below as extra bits. Symbols stay below 72.
+inline uint8_t bucketSymbol(uint32_t value, uint32_t &extra, uint32_t &extra_bits) {
+	if(value < 16) {
+		extra = extra_bits = 0;
+		return static_cast<uint8_t>(value);
+	}
+	uint32_t top = 31 - __builtin_clz(value);
+	extra_bits = top - 1;
+	extra = value & ((1u << extra_bits) - 1);
+	return static_cast<uint8_t>(16 + (top - 4) * 2 + ((value >> extra_bits) & 1));
+}
+
+inline uint32_t bucketExtraBits(uint32_t value) {
+	return value < 16 ? 0 : 30 - __builtin_clz(value);
+}
+
+// reads the extra bits of a symbol, false for symbols that can not occur
+inline bool bucketValue(uint8_t symbol, huffman::BitReader &reader, uint32_t &value) {
+	if(symbol < 16) {
+		value = symbol;
+		return true;
+	}
+	if(symbol >= 72) return false;
+
+	uint32_t extra_bits = (symbol - 16) / 2 + 3;
+	if(reader.count < static_cast<int32_t>(extra_bits)) reader.refill();
+	value = ((2u | ((symbol - 16) & 1)) << extra_bits) | reader.peek(extra_bits);
+	reader.consume(extra_bits);
+	return true;
+}
+
+// bits the entropy coded tokens take, roughly, for the optimal parser
+struct EntropyPrices {
+	// a literal and the no match symbol
+	uint32_t token() const { return 8; }
+	uint32_t length(PairType length) const {
+		return 3 + bucketExtraBits(length - MinMatch + 1);
+	}
+	uint32_t offset(PairType offset) const { return 6 + bucketExtraBits(offset); }
+};
+
+// a Huffman header and the coded symbols, nothing for no symbols.
+// Returns nullptr when out_end leaves no room.
+uint8_t *writeStream(const std::vector<uint8_t> &symbols, uint8_t *out, uint8_t *out_end,
+	CompressorStats &stats) {
+	if(symbols.empty()) return out;
+
+	size_t counters[huffman::NumSymbols];
+	memset(counters, 0, sizeof(counters));
+	simd::histogram(symbols.data(), symbols.size(), counters);
+
+	huffman::Encoder encoder;
+	encoder.build(counters);
+
+	const size_t payload_bits = encoder.payloadBits(counters);
+	const size_t payload_size = (payload_bits + 7) / 8;
+	const size_t room = out_end - out;
+	if(room < encoder.headerSize() + payload_size) return nullptr;
+
+	huffman::BitWriter writer{encoder.writeHeader(out)};
+	if(room >= encoder.headerSize() + payload_size + sizeof(uint64_t)) {
+		writer.encode<false>(encoder.codes(), symbols.data(), symbols.size());
+	} else {
+		writer.encode<true>(encoder.codes(), symbols.data(), symbols.size());
+	}
+	writer.finish();
+
+	stats.header_bytes += encoder.headerSize();
+	stats.coded_symbols += symbols.size();
+	stats.code_bits += payload_bits;
+	return writer.out;
+}
+
+}
+
+CompressorLZ77Huffman::CompressorLZ77Huffman(int level, uint32_t window_bits)
+	: level(std::max(CompressorLZ77::MinLevel, std::min(level, CompressorLZ77::MaxLevel)))
+	, window_bits(std::max(CompressorLZ77::MinWindowBits,
+		std::min(window_bits, CompressorLZ77::MaxWindowBits))) {
+}
+
+size_t CompressorLZ77Huffman::compressBound(size_t data_size) const {
+	// a literal and a length symbol per byte at most, matches cover at least
+	// MinMatch bytes and the extra bits of one fit in 64
+	const size_t max_matches = data_size / MinMatch + 1;
+	return dictionaryIdSize() + HeaderSize + 2 * huffman::maxCodedSize(data_size)
+		+ huffman::maxCodedSize(max_matches) + max_matches * sizeof(uint64_t);
+}
+
+bool CompressorLZ77Huffman::onSetDictionary(const Dictionary *dictionary) {
+	if(dictionary) {
+		finder.setDictionary(dictionary->getContent(), dictionary->getContentSize());
+	} else {
+		finder.setDictionary(nullptr, 0);
+	}
+	return true;
+}
+
+bool CompressorLZ77Huffman::onCompress(const uint8_t *data, size_t data_size,
+	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
+{
+	// the match finder keeps 32-bit positions
+	if(data_size >= UINT32_MAX) return false;
+	if(out_data_size < HeaderSize) return false;
+
+	literals.clear();
+	lengths.clear();
+	offsets.clear();
+	extras.resize(std::max<size_t>(extras.size(), 64));
+
+	huffman::BitWriter extra_writer{extras.data()};
+	size_t pos = 0;
+	size_t num_tokens = 0;
+	size_t match_length_sum = 0;
+	size_t match_offset_sum = 0;
+	PairType last_offset = 0;
+	auto put_extra = [&](uint32_t extra, uint32_t extra_bits) {
+		if(extra_bits == 0) return;
+		extra_writer.put(extra, extra_bits);
+		extra_writer.flushBytes();
+	};
+
+	lz77::parse(finder, scratch, data, data_size, level, window_bits, EntropyPrices(),
+		[&](const lz77::Token &token) {
+			// room for the extra bits of one token
+			size_t used = extra_writer.out - extras.data();
+			if(extras.size() - used < 16) {
+				extras.resize(extras.size() * 2);
+				extra_writer.out = extras.data() + used;
+			}
+
+			uint32_t extra;
+			uint32_t extra_bits;
+			if(token.length == 0) {
+				lengths.push_back(0);
+			} else {
+				lengths.push_back(bucketSymbol(token.length - MinMatch + 1, extra, extra_bits));
+				put_extra(extra, extra_bits);
+				match_length_sum += token.length;
+				match_offset_sum += token.offset;
+
+				if(token.offset == last_offset) {
+					offsets.push_back(0);
+				} else {
+					offsets.push_back(bucketSymbol(token.offset, extra, extra_bits));
+					put_extra(extra, extra_bits);
+				}
+				last_offset = token.offset;
+			}
+
+			pos += token.length;
+			if(pos < data_size) {
+				literals.push_back(token.next);
+				++pos;
+			}
+			++num_tokens;
+			return true;
+		});
+	extra_writer.finish();
+	const size_t extras_size = extra_writer.out - extras.data();
+
+	uint8_t *out_end = out_data + out_data_size;
+	// filled here and copied to the unaligned output once all sizes are known
+	uint32_t header[1 + NumStreams];
+	header[0] = static_cast<uint32_t>(num_tokens);
+
+	// only added to stats when everything fits
+	CompressorStats stream_stats;
+	uint8_t *out = out_data + HeaderSize;
+	const std::vector<uint8_t> *streams[NumStreams] = {&literals, &lengths, &offsets};
+	for(size_t s = 0; s < NumStreams; ++s) {
+		uint8_t *stream_end = writeStream(*streams[s], out, out_end, stream_stats);
+		if(!stream_end) return false;
+		header[1 + s] = static_cast<uint32_t>(stream_end - out);
+		out = stream_end;
+	}
+
+	if(static_cast<size_t>(out_end - out) < extras_size) return false;
+	memcpy(out, extras.data(), extras_size);
+	out += extras_size;
+	memcpy(out_data, header, HeaderSize);
+
+	compressed_size = out - out_data;
+	if(stats) {
+		stats->addNested(stream_stats);
+		stats->header_bytes += HeaderSize;
+		stats->literals += literals.size();
+		stats->matches += offsets.size();
+		stats->match_length_sum += match_length_sum;
+		stats->match_offset_sum += match_offset_sum;
+		stats->match_probes += finder.getProbes();
+	}
+	return true;
+}
+
+bool CompressorLZ77Huffman::onDecompress(const uint8_t *compressed_data,
+	size_t compressed_data_size, uint8_t *data, size_t data_size, size_t &decompressed_size)
+{
+	if(compressed_data_size < HeaderSize) return false;
+
+	const uint8_t *compressed_data_end = compressed_data + compressed_data_size;
+	uint32_t header[1 + NumStreams];
+	memcpy(header, compressed_data, HeaderSize);
+	const size_t num_tokens = header[0];
+
+	huffman::Decoder decoders[NumStreams];
+	huffman::BitReader readers[NumStreams] = {};
+	const uint8_t *stream = compressed_data + HeaderSize;
+	for(size_t s = 0; s < NumStreams; ++s) {
+		const size_t size = header[1 + s];
+		if(size > static_cast<size_t>(compressed_data_end - stream)) return false;
+		const uint8_t *stream_end = stream + size;
+		if(size != 0) {
+			const uint8_t *payload = decoders[s].readHeader(stream, stream_end);
+			if(!payload) return false;
+			readers[s] = huffman::BitReader{payload, stream_end};
+		}
+		stream = stream_end;
+	}
+	huffman::BitReader extra_reader{stream, compressed_data_end};
+
+	// a stream without symbols has no code, the tokens must not use it
+	const bool has_literals = header[1] != 0;
+	const bool has_lengths = header[2] != 0;
+	const bool has_offsets = header[3] != 0;
+	if(num_tokens != 0 && !has_lengths) return false;
+
+	huffman::Decoder &literal_decoder = decoders[0];
+	huffman::Decoder &length_decoder = decoders[1];
+	huffman::Decoder &offset_decoder = decoders[2];
+
+	const uint8_t *dictionary_data = dictionary ? dictionary->getContent() : nullptr;
+	const size_t dictionary_size = dictionary ? dictionary->getContentSize() : 0;
+
+	uint8_t *out = data;
+	uint8_t *data_end = data + data_size;
+	PairType last_offset = 0;
+	for(size_t t = 0; t < num_tokens; ++t) {
+		uint8_t symbol = length_decoder.decode(readers[1]);
+		if(symbol != 0) {
+			uint32_t length;
+			if(!has_offsets || !bucketValue(symbol, extra_reader, length)) return false;
+			length += MinMatch - 1;
+
+			symbol = offset_decoder.decode(readers[2]);
+			PairType offset = last_offset;
+			if(symbol != 0 && !bucketValue(symbol, extra_reader, offset)) return false;
+			last_offset = offset;
+
+			if(offset == 0 || offset > static_cast<size_t>(out - data) + dictionary_size) return false;
+			if(length > static_cast<size_t>(data_end - out)) return false;
+			if(offset > static_cast<size_t>(out - data)) {
+				lz77::copyDictionaryMatch(out, data, dictionary_data, dictionary_size, offset, length);
+			} else {
+				const uint8_t *src = out - offset;
+				for(uint32_t i = 0; i < length; ++i) *out++ = src[i];
+			}
+		}
+
+		if(out == data_end) break;
+		if(!has_literals) return false;
+		*out++ = literal_decoder.decode(readers[0]);
+	}
+
+	decompressed_size = out - data;
+	return true;
+}
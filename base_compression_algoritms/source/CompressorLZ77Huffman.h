@@ -0,0 +1,46 @@
+#pragma once
+#include "CompressorLZ77.h"
+
+#include <vector>
+
+// LZ77 parse with Huffman coded tokens: literals, match lengths and offsets go
+// to their own streams, each with its own code, in the same pass over the data
+class CompressorLZ77Huffman : public Compressor {
+
+public:
+	explicit CompressorLZ77Huffman(int level = CompressorLZ77::DefaultLevel,
+		uint32_t window_bits = 16);
+
+	const char *getTypeName() const override { return "CompressorLZ77Huffman"; }
+
+	std::unique_ptr<Compressor> clone() const override {
+		return std::make_unique<CompressorLZ77Huffman>(level, window_bits);
+	}
+
+	size_t compressBound(size_t data_size) const override;
+
+protected:
+	bool onSetDictionary(const Dictionary *dictionary) override;
+
+	bool onCompress(const uint8_t *data, size_t data_size,
+		uint8_t *out_data, size_t out_data_size, size_t &compressed_size) override;
+	bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+		uint8_t *data, size_t data_size, size_t &decompressed_size) override;
+
+	// a few windows per block, like CompressorLZ77
+	size_t streamBlockSize() const override {
+		return std::max<size_t>(1 << 18, size_t(4) << window_bits);
+	}
+
+private:
+	int level;
+	uint32_t window_bits;
+	lz77::MatchFinder finder;
+
+	// token streams of the last block, kept to reuse their memory
+	std::vector<uint8_t> literals;
+	std::vector<uint8_t> lengths;
+	std::vector<uint8_t> offsets;
+	std::vector<uint8_t> extras;
+
+};
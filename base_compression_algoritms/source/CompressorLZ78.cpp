@@ -1,13 +1,41 @@
 #include "CompressorLZ78.h"
+#include "BitStream.h"
+#include "Dictionary.h"
 #include <cstring>
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
+#include <vector>
 
 using PosType =  uint16_t;
 
 namespace {
 
-const uint32_t DictCapacity = 8192;
+// phrase ids are DictBits wide, 0 is the empty phrase. Both sides start over
+// with an empty dictionary when it is full. Every width is a separate
+// instantiation of the coders, so the inner loops see constants.
+template <uint32_t DictBits>
+struct Config {
+	static_assert(DictBits % 4 == 0 && DictBits <= sizeof(PosType) * 8,
+		"ids are whole nibbles of a PosType");
+
+	static constexpr uint32_t IdBits = DictBits;
+	static constexpr uint32_t DictCapacity = 1u << IdBits;
+	static constexpr uint32_t IdMask = DictCapacity - 1;
+	// LZW codes widen up to the ids
+	static constexpr uint32_t MaxCodeBits = IdBits;
+	// a pending nibble, the header, an id and an 8-bit dt, rounded up to bytes
+	static constexpr size_t MaxTokenSize = (4 + 4 + DictBits + 8 + 7) / 8;
+};
+
+using SmallConfig = Config<CompressorLZ78::MinDictBits>;
+using LargeConfig = Config<CompressorLZ78::MaxDictBits>;
+
+// phrase tokens are nibbles, high nibble first, LZW codes are LSB first
+using NibbleWriter = bitstream::Writer<bitstream::BitOrder::Msb>;
+using NibbleReader = bitstream::Reader<bitstream::BitOrder::Msb>;
+using CodeWriter = bitstream::Writer<bitstream::BitOrder::Lsb>;
+using CodeReader = bitstream::Reader<bitstream::BitOrder::Lsb>;
 
 enum HeaderFlags : unsigned char {
 	None = 0,
@@ -15,6 +43,8 @@ enum HeaderFlags : unsigned char {
 	DtFourBit = 0b0000010,
 	Pos = 0b00000100,
 	PosFourBit = 0b00001000,
+	// pads the last byte, the encoder never sets DtFourBit without Dt
+	End = DtFourBit
 };
 
 struct Node {
@@ -23,200 +53,536 @@ struct Node {
 	uint8_t next;
 };
 
-//djb2
-inline uint16_t hash_function(const uint8_t *data, uint16_t size) {
-	if(size == 0) return 0;
-
-	uint16_t hash = 5381;
-	for(uint16_t i = 0; i < size; ++i) {
-		hash = ((hash << 5) + hash) + data[i]; /* hash * 33 + c */
-	}
-	return hash;
-}
-
 struct RawData {
 	const uint8_t *data;
 	uint16_t size;
 };
 
-template <uint32_t Capacity = 8>
-struct Dict {
+}
 
-	struct Item {
-		RawData data;
-		uint16_t hash;
-	};
+// the phrase trie of the encoder: every phrase is its parent phrase plus one byte,
+// the children are found in an open addressing table keyed by (parent, byte).
+// Extending a phrase by a byte is a single lookup. Slots of older generations
+// are free, so emptying the table is a counter increment.
+class CompressorLZ78::Trie {
+public:
+	// the table is sized for this many phrases, it only grows
+	void prepare(size_t phrases) {
+		size_t table_size = 256;
+		while(table_size < phrases * 2) table_size <<= 1;
+		if(slots.size() < table_size) slots.resize(table_size);
+		mask = table_size - 1;
+		collisions = 0;
+		reset();
+	}
 
-	Dict() {
-		memset(items, 0, sizeof(items));
+	void reset() {
+		if(++generation == 0) {
+			std::fill(slots.begin(), slots.end(), Slot{0, 0, 0});
+			generation = 1;
+		}
 	}
 
-	void append(const RawData &raw_data) {
-		auto hash = hash_function(raw_data.data, raw_data.size);
-		auto &item = items[hash & (Capacity - 1)];
-		item.data = raw_data;
-		item.hash = hash;
+	// id of the phrase parent + byte, 0 when it is not in the dictionary
+	PosType find(PosType parent, uint8_t byte) {
+		const uint32_t key = makeKey(parent, byte);
+		for(size_t i = hash(key);; i = (i + 1) & mask) {
+			const Slot &slot = slots[i];
+			if(slot.generation != generation) return 0;
+			if(slot.key == key) return slot.id;
+			++collisions;
+		}
 	}
 
-	bool has(const uint8_t *data, uint16_t size) const {
-		auto hash = hash_function(data, size);
-		const auto &item = items[hash & (Capacity - 1)];
-		return item.hash == hash && item.data.size == size
-			? memcmp(item.data.data, data, size) == 0 : false;
+	void append(PosType parent, uint8_t byte, PosType id) {
+		const uint32_t key = makeKey(parent, byte);
+		size_t i = hash(key);
+		for(; slots[i].generation == generation; i = (i + 1) & mask) ++collisions;
+		slots[i] = Slot{key, id, generation};
 	}
+
+	// slots probed past since prepare() that held another phrase
+	size_t getCollisions() const { return collisions; }
+
 private:
-	Item items[Capacity];
+	struct Slot {
+		uint32_t key;
+		PosType id;
+		// the slot is in use when this is the current generation
+		uint16_t generation;
+	};
+
+	static uint32_t makeKey(PosType parent, uint8_t byte) {
+		return (uint32_t(parent) << 8) | byte;
+	}
+
+	size_t hash(uint32_t key) const {
+		return (key * 2654435761u >> 8) & mask;
+	}
+
+	std::vector<Slot> slots;
+	size_t mask{0};
+	uint16_t generation{0};
+	size_t collisions{0};
+};
+
+// the phrases that parsing the content of a dictionary adds, in either mode.
+// Messages start their ids at next_id and add their phrases to a trie of their
+// own, when the ids run out they go back to next_id.
+struct CompressorLZ78::DictionaryState {
+	Trie trie;
+	// the decoder table of the ids below next_id, pointing into the content
+	std::vector<RawData> phrases;
+	uint32_t next_id;
 };
 
+namespace {
+
+using DictionaryState = CompressorLZ78::DictionaryState;
+
+// the phrase of parent + byte, in the dictionary first while parent is one of its
+// phrases. Without a dictionary dictionary_end is 0 and no parent is below it.
+inline PosType findPhrase(CompressorLZ78::Trie &trie, DictionaryState *dictionary,
+	uint32_t dictionary_end, PosType parent, uint8_t byte)
+{
+	if(parent < dictionary_end) {
+		if(PosType child = dictionary->trie.find(parent, byte)) return child;
+	}
+	return trie.find(parent, byte);
 }
 
-bool CompressorLZ78::onCompress(const uint8_t *data, size_t data_size,
-	uint8_t *out_data, size_t out_data_size, size_t &compressed_size) {
+// LZW: codes below 256 are single bytes, CLEAR empties the dictionary and
+// the codes from FirstCode on are phrases in the order they were added.
+// Codes are packed LSB first, as wide as the largest code the decoder can get.
+const uint32_t Clear = 256;
+const uint32_t FirstCode = 257;
+const uint32_t MinCodeBits = 9;
+
+// width of codes while the encoder dictionary ends at next_code
+template <typename Config>
+inline uint32_t codeBits(uint32_t next_code) {
+	uint32_t bits = MinCodeBits;
+	while(bits < Config::MaxCodeBits && (next_code - 1) >> bits != 0) ++bits;
+	return bits;
+}
 
-	uint8_t *out = out_data;
-	bool half_byte_switch{false};
-	auto write_4bit = [&](uint8_t  d) {
-		(half_byte_switch ^= 1) ? *out = d << 4 : *out++ |= (d & 0b00001111);
+// the content is parsed like data, its phrases take at most half of the ids
+// so messages have room for their own
+std::unique_ptr<DictionaryState> buildDictionaryState(bool lzw, uint32_t dict_capacity,
+	const uint8_t *content, size_t content_size)
+{
+	const uint32_t max_id = dict_capacity / 2;
+	auto state = std::make_unique<DictionaryState>();
+	state->trie.prepare(max_id);
+	state->phrases.resize(max_id);
+	uint32_t next_id = lzw ? FirstCode : 1;
+
+	auto add = [&](PosType parent, const uint8_t *begin, const uint8_t *last) {
+		state->trie.append(parent, *last, static_cast<PosType>(next_id));
+		state->phrases[next_id++] = RawData{begin, static_cast<uint16_t>(last - begin + 1)};
 	};
 
-	auto write_8bit = [&](uint8_t d) {
-		write_4bit(d >> 4);
-		write_4bit(d & 0b00001111);
-	};
-	auto write_16bit = [&](uint16_t d) {
-		write_8bit(d >> 8);
-		write_8bit(d & 0b0000000011111111);
+	if(lzw) {
+		uint32_t phrase = content_size != 0 ? content[0] : 0;
+		size_t start = 0;
+		for(size_t i = 1; i < content_size && next_id < max_id; ++i) {
+			if(PosType child = state->trie.find(phrase, content[i])) {
+				phrase = child;
+				continue;
+			}
+			add(phrase, content + start, content + i);
+			phrase = content[i];
+			start = i;
+		}
+	} else {
+		for(size_t i = 0; i < content_size && next_id < max_id; ++i) {
+			PosType phrase = 0;
+			const size_t start = i;
+			while(i < content_size - 1) {
+				PosType child = state->trie.find(phrase, content[i]);
+				if(child == 0) break;
+				phrase = child;
+				++i;
+			}
+			add(phrase, content + start, content + i);
+		}
+	}
+
+	state->next_id = next_id;
+	return state;
+}
+
+template <typename Config>
+bool compressLzw(CompressorLZ78::Trie &trie, DictionaryState *dictionary, CompressorStats *stats,
+	const uint8_t *data, size_t data_size, uint8_t *out_data, size_t out_data_size,
+	size_t &compressed_size)
+{
+	uint8_t *out_end = out_data + out_data_size;
+	CodeWriter writer{out_data};
+	// less than 8 bits are pending before a code, whole words are stored
+	// while there is room for one and the last bytes are checked
+	auto write_code = [&](uint32_t code, uint32_t bits) {
+		writer.put(code, bits);
+		if(out_end - writer.out >= static_cast<ptrdiff_t>(sizeof(uint64_t))) {
+			writer.flushWord();
+			return true;
+		}
+		if(out_end - writer.out < static_cast<ptrdiff_t>(writer.count >> 3)) return false;
+		writer.flushBytes();
+		return true;
 	};
 
-	Dict<DictCapacity> dict;
-	const uint8_t *buffer = data;
-	uint16_t buffer_size{0};
+	if(data_size == 0) {
+		compressed_size = 0;
+		return true;
+	}
+
+	// for the stats: byte codes are literals, the others matches
+	size_t literals = 0;
+	size_t hits = 0;
+
+	trie.prepare(std::min<size_t>(data_size + 1, Config::DictCapacity));
+	const size_t dictionary_collisions = dictionary ? dictionary->trie.getCollisions() : 0;
+	const uint32_t dictionary_end = dictionary ? dictionary->next_id : 0;
+	const uint32_t first_code = dictionary ? dictionary->next_id : FirstCode;
+	uint32_t next_code = first_code;
+	uint32_t phrase = data[0];
+	for(size_t i = 1; i < data_size; ++i) {
+		const uint8_t byte = data[i];
+		if(PosType child = findPhrase(trie, dictionary, dictionary_end, static_cast<PosType>(phrase),
+			byte)) {
+			phrase = child;
+			++hits;
+			continue;
+		}
+
+		literals += phrase < Clear;
+		if(!write_code(phrase, codeBits<Config>(next_code))) return false;
+		if(next_code < Config::DictCapacity) {
+			trie.append(phrase, byte, next_code++);
+		} else {
+			if(!write_code(Clear, codeBits<Config>(next_code))) return false;
+			trie.reset();
+			next_code = first_code;
+		}
+		phrase = byte;
+	}
+	literals += phrase < Clear;
+	if(!write_code(phrase, codeBits<Config>(next_code))) return false;
+	if(writer.count > 0 && writer.out == out_end) return false;
+	writer.finish();
+
+	compressed_size = writer.out - out_data;
+	if(stats) {
+		// every byte either starts a code or extends one
+		const size_t codes = data_size - hits;
+		stats->literals += literals;
+		stats->matches += codes - literals;
+		stats->match_length_sum += data_size - literals;
+		stats->dict_hits += hits;
+		stats->dict_collisions += trie.getCollisions()
+			+ (dictionary ? dictionary->trie.getCollisions() - dictionary_collisions : 0);
+	}
+	return true;
+}
+
+template <typename Config>
+bool decompressLzw(ScratchArena &scratch, const DictionaryState *dictionary,
+	const uint8_t *compressed_data, size_t compressed_data_size, uint8_t *data, size_t data_size,
+	size_t &decompressed_size)
+{
+	CodeReader reader{compressed_data, compressed_data + compressed_data_size};
+
+	// phrases are read back from the output, by code. Only codes below
+	// next_code are read, the table needs no clearing.
+	RawData *phrases = scratch.allocate<RawData>(Config::DictCapacity);
+	// codes below first_code are the phrases of the dictionary
+	const RawData *dictionary_phrases = dictionary ? dictionary->phrases.data() : phrases;
+	const uint32_t first_code = dictionary ? dictionary->next_id : FirstCode;
+	uint32_t next_code = first_code;
+	// the previous phrase, the next code is it plus the first byte of the current one
+	RawData prev{nullptr, 0};
+
+	uint8_t *out = data;
+	uint8_t *data_end = data + data_size;
+	for(;;) {
+		// the encoder is one phrase ahead of us once there is a previous one
+		const uint32_t bits = codeBits<Config>(next_code + (prev.data ? 1 : 0));
+		if(reader.count < static_cast<int32_t>(bits)) reader.refill();
+		// what is left is the padding of the last byte
+		if(reader.count < static_cast<int32_t>(bits)) break;
+
+		const uint32_t code = reader.read(bits);
+
+		if(code == Clear) {
+			next_code = first_code;
+			prev = RawData{nullptr, 0};
+			continue;
+		}
+
+		uint8_t *s = out;
+		if(code < Clear) {
+			if(out == data_end) return false;
+			*out++ = static_cast<uint8_t>(code);
+		} else if(code < next_code) {
+			const RawData &d = (code < first_code ? dictionary_phrases : phrases)[code];
+			if(d.size > data_end - out) return false;
+			memcpy(out, d.data, d.size);
+			out += d.size;
+		} else if(code == next_code && prev.data) {
+			// the phrase being defined: the previous one plus its own first byte,
+			// copied bytewise as it reads the byte it has just written
+			if(prev.size + 1u > size_t(data_end - out)) return false;
+			const uint8_t *src = prev.data;
+			for(uint32_t j = 0; j <= prev.size; ++j) *out++ = *src++;
+		} else {
+			return false;
+		}
+
+		if(prev.data && next_code < Config::DictCapacity) {
+			phrases[next_code++] = RawData{prev.data, static_cast<uint16_t>(prev.size + 1)};
+		}
+		prev = RawData{s, static_cast<uint16_t>(out - s)};
+	}
+
+	decompressed_size = out - data;
+	return true;
+}
+
+template <typename Config>
+bool compressPhrases(CompressorLZ78::Trie &trie, DictionaryState *dictionary, CompressorStats *stats,
+	const uint8_t *data, size_t data_size, uint8_t *out_data, size_t out_data_size,
+	size_t &compressed_size)
+{
+	uint8_t *out_end = out_data + out_data_size;
+	NibbleWriter writer{out_data};
+
+	trie.prepare(std::min<size_t>(data_size + 1, Config::DictCapacity));
+	const size_t dictionary_collisions = dictionary ? dictionary->trie.getCollisions() : 0;
+	const uint32_t dictionary_end = dictionary ? dictionary->next_id : 0;
+	const uint32_t first_id = dictionary ? dictionary->next_id : 1;
+	uint32_t next_id{first_id};
 	uint8_t last_next{0};
 	PosType last_pos{0};
 	Node node;
+	// tokens are written in place while a whole one and a word store fit
+	const size_t token_room = Config::MaxTokenSize + sizeof(uint64_t);
+	uint8_t token_buffer[token_room];
+	// for the stats: tokens with a phrase are matches, the others literals
+	size_t tokens = 0;
+	size_t matches = 0;
+	size_t hits = 0;
 
 	for(size_t i = 0; i < data_size; ++i) {
-		while(i < (data_size - 1) && dict.has(buffer, buffer_size + 1)) {
-			++buffer_size;
+		// the longest known phrase, the last byte is always left for next
+		PosType phrase = 0;
+		const size_t start = i;
+		while(i < data_size - 1) {
+			PosType child = findPhrase(trie, dictionary, dictionary_end, phrase, data[i]);
+			if(child == 0) break;
+			phrase = child;
 			++i;
 		}
+		hits += i - start;
+		matches += phrase != 0;
+		++tokens;
 
-		uint8_t next = i < data_size ? buffer[buffer_size] : 0;
+		uint8_t next = data[i];
 		node.next = next - last_next;
 		last_next = next;
 
-		node.header = i < data_size ? HeaderFlags::Dt : HeaderFlags::None;
-
+		node.header = HeaderFlags::Dt;
 		if(node.next < 16) {
 			node.header |= HeaderFlags::DtFourBit;
 		}
 
-		if(buffer_size != 0) {
-			PosType pos = hash_function(buffer, buffer_size) & (DictCapacity - 1);
-			node.pos = pos - last_pos;
-			last_pos = pos;
+		if(phrase != 0) {
+			node.pos = (phrase - last_pos) & Config::IdMask;
+			last_pos = phrase;
 			node.header |= HeaderFlags::Pos;
 			if(node.pos < 16) {
 				node.header |= HeaderFlags::PosFourBit;
 			}
 		}
 
-		//write node
-		write_4bit(node.header);
+		// write node. Near the end of the output it goes through a buffer and
+		// is only copied when it fits, a pending nibble stays in the writer.
+		uint8_t *token_out = writer.out;
+		const bool near_end = static_cast<size_t>(out_end - writer.out) < token_room;
+		if(near_end) writer.out = token_buffer;
+
+		writer.put(node.header, 4);
 		if((node.header & HeaderFlags::Pos) != 0) {
-			if((node.header & HeaderFlags::PosFourBit) != 0)
-				write_4bit(node.pos);
-			else if(sizeof(PosType) == sizeof(uint8_t))
-				write_8bit(node.pos);
-			else
-				write_16bit(node.pos);
+			writer.put(node.pos,
+				((node.header & HeaderFlags::PosFourBit) != 0) ? 4 : Config::IdBits);
 		}
 
 		if((node.header & HeaderFlags::Dt) != 0) {
-			((node.header & HeaderFlags::DtFourBit) != 0)
-				? write_4bit(node.next) : write_8bit(node.next);
+			writer.put(node.next, ((node.header & HeaderFlags::DtFourBit) != 0) ? 4 : 8);
 		}
+		writer.flushWord();
 
-		++buffer_size;
+		if(near_end) {
+			const size_t size = writer.out - token_buffer;
+			if(size > static_cast<size_t>(out_end - token_out)) return false;
+			memcpy(token_out, token_buffer, size);
+			writer.out = token_out + size;
+		}
 
-		dict.append(RawData{buffer, buffer_size});
-		buffer += buffer_size;
-		buffer_size = 0;
+		// no ids are left, both sides start over without this phrase
+		if(next_id == Config::DictCapacity) {
+			trie.reset();
+			next_id = first_id;
+		} else {
+			trie.append(phrase, next, static_cast<PosType>(next_id++));
+		}
 	}
 
-	compressed_size = out - out_data;
-	if(half_byte_switch) ++compressed_size;
+	if(writer.count != 0) {
+		if(writer.out == out_end) return false;
+		writer.put(HeaderFlags::End, 4);
+		writer.finish();
+	}
 
+	compressed_size = writer.out - out_data;
+	if(stats) {
+		stats->literals += tokens - matches;
+		stats->matches += matches;
+		stats->match_length_sum += hits;
+		stats->dict_hits += hits;
+		stats->dict_collisions += trie.getCollisions()
+			+ (dictionary ? dictionary->trie.getCollisions() - dictionary_collisions : 0);
+	}
 	return true;
 }
 
-bool CompressorLZ78::onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
-	uint8_t *data, size_t data_size, size_t &decompressed_size) {
-
-	RawData map[DictCapacity];
-
-	const uint8_t *p = compressed_data;
-	const uint8_t *compressed_data_end = compressed_data + compressed_data_size;
-
-	uint8_t read_byte;
-	bool half_byte_switch{false};
-	auto read_4bit = [&]() {
-		return (half_byte_switch ^= 1) ? ((read_byte = *p++) >> 4) : (read_byte & 0b00001111);
-	};
-
-	auto read_8bit = [&]() {
-		uint8_t ret = read_4bit();
-		return (ret << 4) | read_4bit();
-	};
-
-	auto read_16bit = [&]() {
-		uint16_t ret = read_8bit();
-		return (ret << 8) | read_8bit();
-	};
+template <typename Config>
+bool decompressPhrases(ScratchArena &scratch, const DictionaryState *dictionary,
+	const uint8_t *compressed_data, size_t compressed_data_size, uint8_t *data, size_t data_size,
+	size_t &decompressed_size)
+{
+	// phrases are read back from the output, by id, ids from next_id on are never read.
+	// Ids below first_id are the phrases of the dictionary.
+	RawData *phrases = scratch.allocate<RawData>(Config::DictCapacity);
+	const RawData *dictionary_phrases = dictionary ? dictionary->phrases.data() : phrases;
+	const uint32_t first_id = dictionary ? dictionary->next_id : 1;
+	uint32_t next_id{first_id};
+
+	// reads past the end give zeros, they are caught once the tokens are done
+	NibbleReader reader{compressed_data, compressed_data + compressed_data_size};
 
 	Node node;
 	uint8_t *out = data;
+	uint8_t *data_end = data + data_size;
 	uint8_t last_next{0};
 	PosType last_pos{0};
-	while(p < compressed_data_end) {
-		node.header = read_4bit();
+	// a token can start in the low half of the last byte
+	while(reader.bitsLeft() > 0) {
+		reader.refill();
+		node.header = static_cast<uint8_t>(reader.read(4));
+		if(node.header == HeaderFlags::End) break;
 		node.next = 0;
 		node.pos = 0;
 		if((node.header & HeaderFlags::Pos) != 0) {
-			if((node.header & HeaderFlags::PosFourBit) != 0)
-				node.pos = read_4bit();
-			else if(sizeof(PosType) == sizeof(uint8_t))
-				node.pos = read_8bit();
-			else
-				node.pos = read_16bit();
-			node.pos += last_pos;
+			const uint32_t delta = reader.read(((node.header & HeaderFlags::PosFourBit) != 0)
+				? 4 : Config::IdBits);
+			node.pos = static_cast<PosType>((delta + last_pos) & Config::IdMask);
 			last_pos = node.pos;
 		}
 
 		if((node.header & HeaderFlags::Dt) != 0) {
-			node.next = (((node.header & HeaderFlags::DtFourBit) != 0)
-				? read_4bit() : read_8bit()) + last_next;
+			node.next = static_cast<uint8_t>(reader.read(
+				((node.header & HeaderFlags::DtFourBit) != 0) ? 4 : 8) + last_next);
 		}
 
 		last_next = node.next;
 		uint8_t *s = out;
 		if((node.header & HeaderFlags::Pos) != 0) {
-			const RawData &d = map[node.pos];
-			for(uint16_t j = 0; j < d.size; ++j) {
-				if((out - data) > data_size) return false;
-				*out++ = d.data[j];
-			}
+			if(node.pos == 0 || node.pos >= next_id) return false;
+			const RawData &d = (node.pos < first_id ? dictionary_phrases : phrases)[node.pos];
+			if(d.size > data_end - out) return false;
+			memcpy(out, d.data, d.size);
+			out += d.size;
 		}
 
-		if((out - data) > data_size) return false;
-
-		if((node.header & HeaderFlags::Dt) != 0)
+		if((node.header & HeaderFlags::Dt) != 0) {
+			if(out == data_end) return false;
 			*out++ = node.next;
+		}
 
-		uint16_t size = static_cast<uint16_t>(out - s);
-		map[hash_function(s, size) & (DictCapacity - 1)] = RawData{s, size};
+		if(next_id == Config::DictCapacity) {
+			next_id = first_id;
+		} else {
+			phrases[next_id++] = RawData{s, static_cast<uint16_t>(out - s)};
+		}
 	}
+	// the last token ran into the padding
+	if(reader.bitsLeft() < 0) return false;
 
 	decompressed_size = out - data;
 	return true;
 }
+
+}
+
+CompressorLZ78::CompressorLZ78(Mode mode, uint32_t dict_bits)
+	: mode(mode)
+	, dict_bits(dict_bits <= MinDictBits ? MinDictBits : MaxDictBits) {
+}
+
+CompressorLZ78::~CompressorLZ78() {
+}
+
+size_t CompressorLZ78::compressBound(size_t data_size) const {
+	if(mode == Mode::Lzw) {
+		// a code of up to 16 bits per byte and a CLEAR whenever the codes run out
+		const uint32_t first_code = dictionary_state ? dictionary_state->next_id : FirstCode;
+		return dictionaryIdSize() + 2 * data_size
+			+ 2 * (data_size / ((1u << dict_bits) - first_code) + 1) + 1;
+	}
+	// literal tokens take 3 nibbles, phrase tokens at most 7 for 2 bytes or more
+	return dictionaryIdSize() + data_size + data_size * 3 / 4 + 3;
+}
+
+bool CompressorLZ78::onSetDictionary(const Dictionary *dictionary) {
+	dictionary_state.reset();
+	if(dictionary) {
+		dictionary_state = buildDictionaryState(mode == Mode::Lzw, 1u << dict_bits,
+			dictionary->getContent(), dictionary->getContentSize());
+	}
+	return true;
+}
+
+CompressorLZ78::Trie &CompressorLZ78::getTrie() {
+	if(!trie) trie = std::make_unique<Trie>();
+	return *trie;
+}
+
+bool CompressorLZ78::onCompress(const uint8_t *data, size_t data_size,
+	uint8_t *out_data, size_t out_data_size, size_t &compressed_size) {
+
+	// one branch per call picks the instantiation
+	auto run = [&](auto config) {
+		using C = decltype(config);
+		return mode == Mode::Lzw
+			? compressLzw<C>(getTrie(), dictionary_state.get(), stats, data, data_size,
+				out_data, out_data_size, compressed_size)
+			: compressPhrases<C>(getTrie(), dictionary_state.get(), stats, data, data_size,
+				out_data, out_data_size, compressed_size);
+	};
+	return dict_bits == MinDictBits ? run(SmallConfig()) : run(LargeConfig());
+}
+
+bool CompressorLZ78::onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+	uint8_t *data, size_t data_size, size_t &decompressed_size) {
+
+	auto run = [&](auto config) {
+		using C = decltype(config);
+		return mode == Mode::Lzw
+			? decompressLzw<C>(scratch, dictionary_state.get(), compressed_data,
+				compressed_data_size, data, data_size, decompressed_size)
+			: decompressPhrases<C>(scratch, dictionary_state.get(), compressed_data,
+				compressed_data_size, data, data_size, decompressed_size);
+	};
+	return dict_bits == MinDictBits ? run(SmallConfig()) : run(LargeConfig());
+}
@@ -4,12 +4,56 @@
 class CompressorLZ78 : public Compressor {
 	
 public:
-	const char *getTypeName() const override { return "CompressorLZ78"; }
+	enum class Mode : uint8_t {
+		// tokens are a known phrase and the byte after it
+		Phrase,
+		// tokens are phrase codes only, in codes that widen as the dictionary grows
+		Lzw
+	};
+
+	// phrase ids are 12 or 16 bits wide, each width is compiled on its own.
+	// 12 bits write shorter ids and keep a smaller dictionary, it suits small
+	// messages that never fill 4096 phrases. Widths in between take 16.
+	static constexpr uint32_t MinDictBits = 12;
+	static constexpr uint32_t MaxDictBits = 16;
+
+	explicit CompressorLZ78(Mode mode = Mode::Phrase, uint32_t dict_bits = MaxDictBits);
+	~CompressorLZ78() override;
+
+	const char *getTypeName() const override {
+		return mode == Mode::Lzw ? "CompressorLZW" : "CompressorLZ78";
+	}
+
+	std::unique_ptr<Compressor> clone() const override {
+		return std::make_unique<CompressorLZ78>(mode, dict_bits);
+	}
+
+	size_t compressBound(size_t data_size) const override;
 
 protected:
+	// both sides start with the phrases of the dictionary content
+	bool onSetDictionary(const Dictionary *dictionary) override;
+
 	bool onCompress(const uint8_t *data, size_t data_size,
 		uint8_t *out_data, size_t out_data_size, size_t &compressed_size) override;
 	bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
 		uint8_t *data, size_t data_size, size_t &decompressed_size) override;
 
+	// the dictionary is rebuilt for every block
+	size_t streamBlockSize() const override { return 1 << 16; }
+
+public:
+	class Trie;
+	struct DictionaryState;
+
+private:
+	Trie &getTrie();
+
+	Mode mode;
+	uint32_t dict_bits;
+	// the encoder dictionary, kept for the next call
+	std::unique_ptr<Trie> trie;
+	// the phrases of a set dictionary, never changed by the data
+	std::unique_ptr<DictionaryState> dictionary_state;
+
 };
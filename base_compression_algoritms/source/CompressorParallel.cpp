@@ -0,0 +1,285 @@
+#include "CompressorParallel.h"
+#include "SimdKernels.h"
+
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+
+// frame: [header][index entry per block][blocks]
+// header: [uint32 magic][uint32 block size][uint64 size][uint32 block count]
+// [uint32 CRC-32C of the header before it and the index]
+// index entry: [uint32 compressed size][uint32 CRC-32C of the original block]
+const uint32_t FrameMagic = 0x31465043; // "CPF1"
+const size_t HeaderSize = sizeof(uint32_t) * 2 + sizeof(uint64_t) + sizeof(uint32_t) * 2;
+const size_t HeaderChecksumOffset = HeaderSize - sizeof(uint32_t);
+const size_t IndexEntrySize = sizeof(uint32_t) * 2;
+
+// the fields are not aligned in the frame
+inline uint32_t read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint64_t read64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline void write32(uint8_t *p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+inline void write64(uint8_t *p, uint64_t v) { memcpy(p, &v, sizeof(v)); }
+
+// no rounding up by adding, data_size comes from the frame and can be anything
+inline size_t blockCount(size_t data_size, size_t block_size) {
+	return data_size / block_size + (data_size % block_size != 0);
+}
+
+struct Frame {
+	size_t data_size;
+	size_t block_size;
+	size_t num_blocks;
+	const uint8_t *index;
+	// start of every block in the frame, and the frame end
+	std::vector<size_t> offsets;
+
+	size_t blockDataSize(size_t block) const {
+		return std::min(block_size, data_size - block * block_size);
+	}
+	uint32_t blockCompressedSize(size_t block) const {
+		return read32(index + block * IndexEntrySize);
+	}
+	uint32_t blockChecksum(size_t block) const {
+		return read32(index + block * IndexEntrySize + sizeof(uint32_t));
+	}
+};
+
+bool parseFrame(const uint8_t *compressed_data, size_t compressed_data_size, Frame &frame,
+	bool with_offsets)
+{
+	if(compressed_data_size < HeaderSize) return false;
+
+	if(read32(compressed_data) != FrameMagic) return false;
+
+	frame.block_size = read32(compressed_data + sizeof(uint32_t));
+	frame.data_size = read64(compressed_data + sizeof(uint32_t) * 2);
+	frame.num_blocks = read32(compressed_data + sizeof(uint32_t) * 2 + sizeof(uint64_t));
+	if(frame.block_size < CompressorParallel::MinBlockSize
+		|| frame.block_size > CompressorParallel::MaxBlockSize) return false;
+	if(frame.num_blocks != blockCount(frame.data_size, frame.block_size)) return false;
+	if((compressed_data_size - HeaderSize) / IndexEntrySize < frame.num_blocks) return false;
+
+	const size_t index_size = frame.num_blocks * IndexEntrySize;
+	uint32_t checksum = simd::crc32c(0, compressed_data, HeaderChecksumOffset);
+	checksum = simd::crc32c(checksum, compressed_data + HeaderSize, index_size);
+	if(checksum != read32(compressed_data + HeaderChecksumOffset)) return false;
+
+	frame.index = compressed_data + HeaderSize;
+	if(!with_offsets) return true;
+
+	frame.offsets.resize(frame.num_blocks + 1);
+	frame.offsets[0] = HeaderSize + index_size;
+	for(size_t i = 0; i < frame.num_blocks; ++i) {
+		frame.offsets[i + 1] = frame.offsets[i] + frame.blockCompressedSize(i);
+	}
+	return frame.offsets[frame.num_blocks] <= compressed_data_size;
+}
+
+}
+
+CompressorParallel::CompressorParallel(std::unique_ptr<Compressor> compressor, size_t num_threads,
+	size_t block_size)
+	: CompressorParallel(std::move(compressor), std::make_shared<ThreadPool>(num_threads), block_size)
+{
+}
+
+CompressorParallel::CompressorParallel(std::unique_ptr<Compressor> compressor,
+	std::shared_ptr<ThreadPool> pool, size_t block_size)
+	: compressor(std::move(compressor))
+	, block_size(std::max(MinBlockSize, std::min(block_size, MaxBlockSize)))
+	, pool(std::move(pool))
+{
+	name = std::string("CompressorParallel(") + this->compressor->getTypeName() + ")";
+	worker_compressors.resize(this->pool->size());
+	worker_scratch.resize(this->pool->size());
+	worker_stats.resize(this->pool->size());
+}
+
+Compressor &CompressorParallel::workerCompressor(size_t worker) {
+	if(worker == 0) return *compressor;
+
+	std::unique_ptr<Compressor> &instance = worker_compressors[worker];
+	if(!instance) instance = compressor->clone();
+	return *instance;
+}
+
+bool CompressorParallel::decompressBlock(size_t worker, const uint8_t *compressed_block,
+	size_t compressed_size, uint32_t checksum, uint8_t *data, size_t data_size)
+{
+	size_t decompressed_size;
+	return workerCompressor(worker).decompress(compressed_block, compressed_size, data, data_size,
+		decompressed_size) && decompressed_size == data_size
+		&& simd::crc32c(0, data, data_size) == checksum;
+}
+
+bool CompressorParallel::frameDataSize(const uint8_t *compressed_data,
+	size_t compressed_data_size, size_t &data_size)
+{
+	Frame frame;
+	if(!compressed_data || !parseFrame(compressed_data, compressed_data_size, frame, false)) {
+		return false;
+	}
+	data_size = frame.data_size;
+	return true;
+}
+
+size_t CompressorParallel::compressBound(size_t data_size) const {
+	const size_t num_blocks = blockCount(data_size, block_size);
+	const size_t full_blocks = data_size / block_size;
+	size_t bound = HeaderSize + num_blocks * IndexEntrySize
+		+ full_blocks * compressor->compressBound(block_size);
+	if(full_blocks != num_blocks) bound += compressor->compressBound(data_size % block_size);
+	return bound;
+}
+
+bool CompressorParallel::onCompress(const uint8_t *data, size_t data_size,
+	uint8_t *out_data, size_t out_data_size, size_t &compressed_size)
+{
+	const size_t num_blocks = blockCount(data_size, block_size);
+	if(num_blocks > UINT32_MAX) return false;
+	const size_t index_size = num_blocks * IndexEntrySize;
+	if(out_data_size < HeaderSize + index_size) return false;
+
+	uint8_t *index = out_data + HeaderSize;
+	uint8_t *slots = index + index_size;
+
+	// with room for the bound of every block each one is compressed into its own
+	// slot of the output and the slots are closed up afterwards, otherwise the
+	// blocks wait in buffers of their own
+	const size_t slot_size = compressor->compressBound(block_size);
+	const bool in_place = out_data_size >= compressBound(data_size);
+	if(!in_place) blocks.resize(num_blocks);
+
+	std::fill(worker_stats.begin(), worker_stats.end(), CompressorStats());
+	std::atomic<bool> failed{false};
+	pool->parallelFor(num_blocks, [&](size_t block, size_t worker) {
+		const size_t offset = block * block_size;
+		const size_t size = std::min(block_size, data_size - offset);
+
+		Compressor &codec = workerCompressor(worker);
+		codec.setStats(stats ? &worker_stats[worker] : nullptr);
+
+		const size_t bound = codec.compressBound(size);
+		uint8_t *target;
+		if(in_place) {
+			target = slots + block * slot_size;
+		} else {
+			blocks[block].resize(bound);
+			target = blocks[block].data();
+		}
+
+		size_t block_compressed_size;
+		if(!codec.compress(data + offset, size, target, bound, block_compressed_size)
+			|| block_compressed_size > UINT32_MAX) {
+			failed = true;
+			return;
+		}
+		write32(index + block * IndexEntrySize, static_cast<uint32_t>(block_compressed_size));
+		write32(index + block * IndexEntrySize + sizeof(uint32_t),
+			simd::crc32c(0, data + offset, size));
+	});
+	if(failed) return false;
+
+	write32(out_data, FrameMagic);
+	write32(out_data + sizeof(uint32_t), static_cast<uint32_t>(block_size));
+	write64(out_data + sizeof(uint32_t) * 2, data_size);
+	write32(out_data + sizeof(uint32_t) * 2 + sizeof(uint64_t), static_cast<uint32_t>(num_blocks));
+	uint32_t checksum = simd::crc32c(0, out_data, HeaderChecksumOffset);
+	write32(out_data + HeaderChecksumOffset,
+		simd::crc32c(checksum, out_data + HeaderSize, index_size));
+
+	uint8_t *out = slots;
+	for(size_t i = 0; i < num_blocks; ++i) {
+		const size_t size = read32(index + i * IndexEntrySize);
+		if(size > static_cast<size_t>(out_data + out_data_size - out)) return false;
+		// the first slot is where its block goes, the others only move down
+		const uint8_t *block = in_place ? slots + i * slot_size : blocks[i].data();
+		if(block != out) memmove(out, block, size);
+		out += size;
+	}
+
+	compressed_size = out - out_data;
+	if(stats) {
+		for(const CompressorStats &worker : worker_stats) stats->addNested(worker);
+		stats->header_bytes += HeaderSize + index_size;
+	}
+	return true;
+}
+
+bool CompressorParallel::onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+	uint8_t *data, size_t data_size, size_t &decompressed_size)
+{
+	Frame frame;
+	if(!parseFrame(compressed_data, compressed_data_size, frame, true)) return false;
+	if(frame.data_size > data_size) return false;
+
+	std::atomic<bool> failed{false};
+	pool->parallelFor(frame.num_blocks, [&](size_t block, size_t worker) {
+		if(!decompressBlock(worker, compressed_data + frame.offsets[block],
+			frame.blockCompressedSize(block), frame.blockChecksum(block),
+			data + block * frame.block_size, frame.blockDataSize(block))) {
+			failed = true;
+		}
+	});
+	if(failed) return false;
+
+	decompressed_size = frame.data_size;
+	return true;
+}
+
+bool CompressorParallel::decompressRange(const uint8_t *compressed_data,
+	size_t compressed_data_size, size_t offset, size_t size, uint8_t *out)
+{
+	if(!compressed_data || (!out && size != 0)) return false;
+
+	Frame frame;
+	if(!parseFrame(compressed_data, compressed_data_size, frame, true)) return false;
+	if(offset > frame.data_size || size > frame.data_size - offset) return false;
+	if(size == 0) return true;
+
+	const size_t first = offset / frame.block_size;
+	const size_t last = (offset + size - 1) / frame.block_size;
+	if(last >= frame.num_blocks) return false;
+
+	std::atomic<bool> failed{false};
+	pool->parallelFor(last - first + 1, [&](size_t i, size_t worker) {
+		const size_t block = first + i;
+		const size_t block_offset = block * frame.block_size;
+		const size_t block_size = frame.blockDataSize(block);
+		const uint8_t *compressed_block = compressed_data + frame.offsets[block];
+
+		// blocks inside the range are decoded in place, the ones on its edges
+		// go through the scratch buffer
+		const size_t begin = std::max(offset, block_offset);
+		const size_t end = std::min(offset + size, block_offset + block_size);
+		uint8_t *target = out + (begin - offset);
+		if(begin == block_offset && end == block_offset + block_size) {
+			if(!decompressBlock(worker, compressed_block, frame.blockCompressedSize(block),
+				frame.blockChecksum(block), target, block_size)) failed = true;
+			return;
+		}
+
+		std::vector<uint8_t> &scratch = worker_scratch[worker];
+		scratch.resize(block_size);
+		if(!decompressBlock(worker, compressed_block, frame.blockCompressedSize(block),
+			frame.blockChecksum(block), scratch.data(), block_size)) {
+			failed = true;
+			return;
+		}
+		memcpy(target, scratch.data() + (begin - block_offset), end - begin);
+	});
+
+	return !failed;
+}
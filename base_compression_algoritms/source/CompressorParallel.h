@@ -0,0 +1,76 @@
+#pragma once
+#include "Compressor.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <string>
+
+// splits the data into independent blocks and runs another compressor on them
+// in parallel. The output only depends on the block size, not on the threads.
+// The frame indexes its blocks and checksums them, so any byte range can be read
+// back by decompressing only the blocks that cover it.
+class CompressorParallel : public Compressor {
+
+public:
+	static constexpr size_t MinBlockSize = 1 << 16;
+	static constexpr size_t MaxBlockSize = 1 << 26;
+	static constexpr size_t DefaultBlockSize = 1 << 20;
+
+	// num_threads 0 uses every hardware thread
+	explicit CompressorParallel(std::unique_ptr<Compressor> compressor, size_t num_threads = 0,
+		size_t block_size = DefaultBlockSize);
+
+	const char *getTypeName() const override { return name.c_str(); }
+
+	// the clones share the pool, a batch over clones does not start threads for each
+	std::unique_ptr<Compressor> clone() const override {
+		return std::unique_ptr<Compressor>(
+			new CompressorParallel(compressor->clone(), pool, block_size));
+	}
+
+	size_t compressBound(size_t data_size) const override;
+
+	// size of the original data of a frame, the header is validated
+	static bool frameDataSize(const uint8_t *compressed_data, size_t compressed_data_size,
+		size_t &data_size);
+
+	// reads bytes [offset, offset + size) of the original data into out
+	bool decompressRange(const uint8_t *compressed_data, size_t compressed_data_size,
+		size_t offset, size_t size, uint8_t *out);
+
+protected:
+	bool onCompress(const uint8_t *data, size_t data_size,
+		uint8_t *out_data, size_t out_data_size, size_t &compressed_size) override;
+	bool onDecompress(const uint8_t *compressed_data, size_t compressed_data_size,
+		uint8_t *data, size_t data_size, size_t &decompressed_size) override;
+
+	// enough blocks for every worker
+	size_t streamBlockSize() const override {
+		return std::min<size_t>(block_size * pool->size(), 1 << 30);
+	}
+
+private:
+	CompressorParallel(std::unique_ptr<Compressor> compressor, std::shared_ptr<ThreadPool> pool,
+		size_t block_size);
+
+	// one instance per worker, compressors are not shared between threads
+	Compressor &workerCompressor(size_t worker);
+
+	// decompresses a block and checks it against its checksum
+	bool decompressBlock(size_t worker, const uint8_t *compressed_block, size_t compressed_size,
+		uint32_t checksum, uint8_t *data, size_t data_size);
+
+	std::unique_ptr<Compressor> compressor;
+	size_t block_size;
+	std::string name;
+	// calls from several instances are run one after another
+	std::shared_ptr<ThreadPool> pool;
+	std::vector<std::unique_ptr<Compressor>> worker_compressors;
+	// compressed blocks waiting to be written in order, when the output has no
+	// room for all their bounds
+	std::vector<std::vector<uint8_t>> blocks;
+	std::vector<std::vector<uint8_t>> worker_scratch;
+	// what the workers counted during the current compress call
+	std::vector<CompressorStats> worker_stats;
+
+};
@@ -0,0 +1,211 @@
+#include "Dictionary.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+const uint32_t DictionaryMagic = 0x54434443; // "CDCT"
+const size_t HeaderSize = sizeof(uint32_t) * 3 + huffman::NumSymbols / 2;
+
+// load() takes any buffer, the fields need not be aligned
+inline uint32_t read32(const uint8_t *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+inline void write32(uint8_t *p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+// content is picked in segments of this size, scored by the k-mers in them
+const size_t SegmentSize = 64;
+const size_t KmerSize = 8;
+const uint32_t KmerHashBits = 20;
+
+inline uint32_t hashKmer(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return static_cast<uint32_t>((v * 0x9E3779B97F4A7C15ull) >> (64 - KmerHashBits));
+}
+
+struct Segment {
+	const uint8_t *data;
+	size_t size;
+	uint64_t score;
+};
+
+// the samples are cut into one epoch per segment of content, every epoch gives
+// the window whose k-mers are in the most samples. The k-mers of a chosen
+// window no longer count, so later epochs pick something else.
+std::vector<Segment> pickSegments(const std::vector<Dictionary::Sample> &samples,
+	size_t content_size)
+{
+	// samples each k-mer is in, counted once per sample
+	std::vector<uint32_t> counts(size_t(1) << KmerHashBits, 0);
+	std::vector<uint32_t> last_sample(size_t(1) << KmerHashBits, 0);
+	size_t total = 0;
+	for(size_t s = 0; s < samples.size(); ++s) {
+		const Dictionary::Sample &sample = samples[s];
+		total += sample.size;
+		for(size_t pos = 0; pos + KmerSize <= sample.size; ++pos) {
+			const uint32_t h = hashKmer(sample.data + pos);
+			if(last_sample[h] == s + 1) continue;
+			last_sample[h] = static_cast<uint32_t>(s + 1);
+			counts[h]++;
+		}
+	}
+
+	// a k-mer of a single sample saves nothing, unless there is just the one
+	const uint32_t min_count = samples.size() > 1 ? 2 : 1;
+	auto score = [&](const uint8_t *p) -> uint64_t {
+		const uint32_t count = counts[hashKmer(p)];
+		return count >= min_count ? count : 0;
+	};
+
+	std::vector<Segment> segments;
+	const size_t num_epochs = std::max<size_t>(1, content_size / SegmentSize);
+	const size_t epoch_size = std::max<size_t>(1, total / num_epochs);
+	size_t epoch_end = epoch_size;
+	Segment best{nullptr, 0, 0};
+	auto end_epoch = [&]() {
+		if(best.score == 0) return;
+		for(size_t pos = 0; pos + KmerSize <= best.size; ++pos) {
+			counts[hashKmer(best.data + pos)] = 0;
+		}
+		segments.push_back(best);
+		best = Segment{nullptr, 0, 0};
+	};
+
+	size_t offset = 0;
+	for(const Dictionary::Sample &sample : samples) {
+		const size_t window = std::min(SegmentSize, sample.size);
+		if(window < KmerSize) {
+			offset += sample.size;
+			continue;
+		}
+
+		// the window score slides along, it is summed up again after an epoch
+		// changed the counts
+		uint64_t sum = 0;
+		bool fresh = true;
+		for(size_t pos = 0; pos + window <= sample.size; ++pos) {
+			if(offset + pos >= epoch_end) {
+				end_epoch();
+				epoch_end += epoch_size;
+				fresh = true;
+			}
+
+			if(fresh) {
+				sum = 0;
+				for(size_t k = 0; k + KmerSize <= window; ++k) sum += score(sample.data + pos + k);
+				fresh = false;
+			} else {
+				sum += score(sample.data + pos + window - KmerSize);
+				sum -= score(sample.data + pos - 1);
+			}
+
+			if(sum > best.score) best = Segment{sample.data + pos, window, sum};
+		}
+		offset += sample.size;
+	}
+	end_epoch();
+
+	return segments;
+}
+
+}
+
+Dictionary::Dictionary(uint32_t id, std::vector<uint8_t> content, const uint8_t *code_lengths)
+	: id(id), content(std::move(content)) {
+	memcpy(this->code_lengths, code_lengths, sizeof(this->code_lengths));
+}
+
+std::shared_ptr<Dictionary> Dictionary::train(uint32_t id, const std::vector<Sample> &samples,
+	size_t content_size)
+{
+	content_size = std::min(content_size, MaxContentSize);
+
+	// every symbol gets a code, the ones not in the samples the longest
+	size_t counters[huffman::NumSymbols];
+	std::fill(counters, counters + huffman::NumSymbols, 1);
+	size_t total = 0;
+	for(const Sample &sample : samples) {
+		for(size_t i = 0; i < sample.size; ++i) counters[sample.data[i]]++;
+		total += sample.size;
+	}
+	huffman::Encoder encoder;
+	encoder.build(counters);
+
+	std::vector<uint8_t> content;
+	if(total <= content_size) {
+		// small enough to be taken whole, the last sample ends nearest to the data
+		for(const Sample &sample : samples) {
+			content.insert(content.end(), sample.data, sample.data + sample.size);
+		}
+	} else {
+		std::vector<Segment> segments = pickSegments(samples, content_size);
+		std::stable_sort(segments.begin(), segments.end(),
+			[](const Segment &s0, const Segment &s1) { return s0.score < s1.score; });
+
+		// the best segments are kept when they do not all fit
+		size_t size = 0;
+		size_t first = segments.size();
+		while(first > 0 && size + segments[first - 1].size <= content_size) {
+			size += segments[--first].size;
+		}
+		content.reserve(size);
+		for(size_t i = first; i < segments.size(); ++i) {
+			content.insert(content.end(), segments[i].data, segments[i].data + segments[i].size);
+		}
+	}
+
+	return std::make_shared<Dictionary>(id, std::move(content), encoder.codeLengths());
+}
+
+std::vector<uint8_t> Dictionary::save() const {
+	std::vector<uint8_t> out(HeaderSize + content.size());
+	write32(out.data(), DictionaryMagic);
+	write32(out.data() + sizeof(uint32_t), id);
+	write32(out.data() + sizeof(uint32_t) * 2, static_cast<uint32_t>(content.size()));
+
+	uint8_t *lengths = out.data() + sizeof(uint32_t) * 3;
+	for(size_t i = 0; i < huffman::NumSymbols; i += 2) {
+		*lengths++ = (code_lengths[i] << 4) | code_lengths[i + 1];
+	}
+	if(!content.empty()) memcpy(lengths, content.data(), content.size());
+	return out;
+}
+
+std::shared_ptr<Dictionary> Dictionary::load(const uint8_t *data, size_t size) {
+	if(!data || size < HeaderSize) return nullptr;
+
+	if(read32(data) != DictionaryMagic) return nullptr;
+	const size_t content_size = read32(data + sizeof(uint32_t) * 2);
+	if(content_size > MaxContentSize || content_size != size - HeaderSize) return nullptr;
+
+	uint8_t code_lengths[huffman::NumSymbols];
+	const uint8_t *lengths = data + sizeof(uint32_t) * 3;
+	for(size_t i = 0; i < huffman::NumSymbols; i += 2) {
+		code_lengths[i] = *lengths >> 4;
+		code_lengths[i + 1] = *lengths++ & 0b00001111;
+	}
+
+	// a code for every symbol, and one that a decoder accepts
+	if(std::count(code_lengths, code_lengths + huffman::NumSymbols, 0) != 0) return nullptr;
+	huffman::Encoder encoder;
+	if(!encoder.buildFromLengths(code_lengths)) return nullptr;
+
+	return std::make_shared<Dictionary>(read32(data + sizeof(uint32_t)),
+		std::vector<uint8_t>(lengths, lengths + content_size), code_lengths);
+}
+
+bool Dictionary::saveFile(const char *path) const {
+	const std::vector<uint8_t> data = save();
+	MappedFile out;
+	if(!out.openWrite(path, data.size())) return false;
+	memcpy(out.writableData(), data.data(), data.size());
+	return out.close();
+}
+
+std::shared_ptr<Dictionary> Dictionary::loadFile(const char *path) {
+	MappedFile in;
+	if(!in.openRead(path)) return nullptr;
+	return load(in.data(), in.size());
+}
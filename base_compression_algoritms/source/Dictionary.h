@@ -0,0 +1,52 @@
+#pragma once
+#include "HuffmanCoder.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// what both sides of small messages know in advance: content the messages can
+// reference as if it came right before them, and a static Huffman code for
+// their bytes. It is trained once from samples of the messages and loaded on
+// both sides, the messages only carry its id.
+class Dictionary {
+public:
+	static constexpr size_t DefaultContentSize = 1 << 15;
+	// the reach of the default LZ77 window
+	static constexpr size_t MaxContentSize = 1 << 16;
+
+	struct Sample {
+		const uint8_t *data;
+		size_t size;
+	};
+
+	// code_lengths has a code for every symbol and content is at most
+	// MaxContentSize bytes, load() checks both. CompressorHuffman refuses a
+	// dictionary whose code misses a symbol.
+	Dictionary(uint32_t id, std::vector<uint8_t> content, const uint8_t *code_lengths);
+
+	// content from the segments that repeat across the most samples, the most
+	// common ones last where they are the nearest to the data, and a code for
+	// the bytes of all samples
+	static std::shared_ptr<Dictionary> train(uint32_t id, const std::vector<Sample> &samples,
+		size_t content_size = DefaultContentSize);
+
+	// [uint32 magic][uint32 id][uint32 content size][code lengths, 4 bits each][content].
+	// Loading returns nullptr for anything else.
+	std::vector<uint8_t> save() const;
+	static std::shared_ptr<Dictionary> load(const uint8_t *data, size_t size);
+
+	bool saveFile(const char *path) const;
+	static std::shared_ptr<Dictionary> loadFile(const char *path);
+
+	uint32_t getId() const { return id; }
+	const uint8_t *getContent() const { return content.data(); }
+	size_t getContentSize() const { return content.size(); }
+	const uint8_t *getCodeLengths() const { return code_lengths; }
+
+private:
+	uint32_t id;
+	std::vector<uint8_t> content;
+	uint8_t code_lengths[huffman::NumSymbols];
+};
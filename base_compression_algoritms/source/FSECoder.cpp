@@ -0,0 +1,307 @@
+#include "FSECoder.h"
+
+#include <algorithm>
+
+namespace fse
+{
+
+namespace
+{
+
+// the rounds of encode and decode are written out for four states
+static_assert(NumStates == 4, "a round steps every state once");
+
+inline uint32_t highBit(uint32_t v) {
+	return 31 - __builtin_clz(v);
+}
+
+// bits of the values 0 to v
+inline uint32_t bitWidth(uint32_t v) {
+	return v != 0 ? highBit(v) + 1 : 0;
+}
+
+// the states of a symbol are spread over the table so its next states are
+// evenly apart. The step is odd, every position is visited once.
+void spreadSymbols(const uint16_t *norm, uint32_t table_log, uint8_t *symbols) {
+	const uint32_t size = 1u << table_log;
+	const uint32_t mask = size - 1;
+	const uint32_t step = (size >> 1) + (size >> 3) + 3;
+	uint32_t pos = 0;
+	for(size_t s = 0; s < NumSymbols; ++s) {
+		for(uint32_t i = 0; i < norm[s]; ++i) {
+			symbols[pos] = static_cast<uint8_t>(s);
+			pos = (pos + step) & mask;
+		}
+	}
+}
+
+}
+
+void Encoder::build(const size_t *counters, size_t data_size, uint32_t max_table_log) {
+	max_symbol = 0;
+	for(size_t s = 0; s < NumSymbols; ++s) {
+		if(counters[s] != 0) max_symbol = static_cast<uint32_t>(s);
+	}
+
+	// fewer states for small inputs, but at least two per possible symbol
+	const uint32_t source_bits = data_size > 1
+		? highBit(static_cast<uint32_t>(std::min<size_t>(data_size - 1, UINT32_MAX))) : 0;
+	table_log = std::min(max_table_log, source_bits > 2 ? source_bits - 2 : 0);
+	table_log = std::max(table_log, std::min(source_bits + 1, bitWidth(max_symbol) + 1));
+	table_log = std::max(MinTableLog, std::min(table_log, MaxTableLog));
+
+	// rounded shares, every present symbol keeps at least one state. The
+	// largest share takes what is left over or gives back what is missing.
+	const uint32_t total = 1u << table_log;
+	uint32_t sum = 0;
+	for(size_t s = 0; s < NumSymbols; ++s) {
+		if(counters[s] == 0) {
+			norm[s] = 0;
+			continue;
+		}
+		const uint64_t n = (uint64_t(counters[s]) * total + data_size / 2) / data_size;
+		norm[s] = static_cast<uint16_t>(std::max<uint64_t>(n, 1));
+		sum += norm[s];
+	}
+	if(sum <= total) {
+		*std::max_element(norm, norm + NumSymbols) += static_cast<uint16_t>(total - sum);
+	}
+	while(sum > total) {
+		uint16_t *n = std::max_element(norm, norm + NumSymbols);
+		const uint32_t take = std::min<uint32_t>(sum - total, *n - 1);
+		*n -= static_cast<uint16_t>(take);
+		sum -= take;
+	}
+
+	uint8_t symbols[1 << MaxTableLog];
+	spreadSymbols(norm, table_log, symbols);
+
+	// the states of each symbol in a row, in table order
+	uint32_t next[NumSymbols];
+	uint32_t cumul = 0;
+	for(size_t s = 0; s < NumSymbols; ++s) {
+		next[s] = cumul;
+		cumul += norm[s];
+	}
+	for(uint32_t u = 0; u < total; ++u) {
+		state_table[next[symbols[u]]++] = static_cast<uint16_t>(total + u);
+	}
+
+	// a state of symbol s writes max_bits or one bit less, the bit count
+	// comes out of the high half of state + delta_nb_bits. next[s] is past
+	// the states of s by now.
+	for(size_t s = 0; s < NumSymbols; ++s) {
+		const uint32_t n = norm[s];
+		if(n == 0) continue;
+		const uint32_t max_bits = table_log - (n > 1 ? highBit(n - 1) : 0);
+		transforms[s].delta_nb_bits = (max_bits << 16) - (n << max_bits);
+		transforms[s].delta_find_state = static_cast<int32_t>(next[s] - n) - static_cast<int32_t>(n);
+	}
+}
+
+size_t Encoder::headerSize() const {
+	// the same walk as writeHeader
+	size_t bits = 4 + 8;
+	uint32_t remaining = 1u << table_log;
+	for(uint32_t s = 0; s <= max_symbol && remaining > 0; ++s) {
+		bits += bitWidth(remaining);
+		remaining -= norm[s];
+		if(norm[s] == 0) {
+			uint32_t run = 0;
+			while(s + run < max_symbol && norm[s + run + 1] == 0) ++run;
+			s += run;
+			bits += (run / 3 + 1) * 2;
+		}
+	}
+	return (bits + 7) / 8;
+}
+
+uint8_t *Encoder::writeHeader(uint8_t *out) const {
+	huffman::BitWriter writer{out};
+	writer.put(table_log - MinTableLog, 4);
+	writer.put(max_symbol, 8);
+	writer.flushBytes();
+
+	// every count in as many bits as the states left need, a zero is
+	// followed by the run of zeros after it in 2-bit steps
+	uint32_t remaining = 1u << table_log;
+	for(uint32_t s = 0; s <= max_symbol && remaining > 0; ++s) {
+		writer.put(norm[s], bitWidth(remaining));
+		remaining -= norm[s];
+		if(norm[s] == 0) {
+			uint32_t run = 0;
+			while(s + run < max_symbol && norm[s + run + 1] == 0) ++run;
+			s += run;
+			for(; run >= 3; run -= 3) {
+				writer.put(3, 2);
+				writer.flushBytes();
+			}
+			writer.put(run, 2);
+		}
+		writer.flushBytes();
+	}
+
+	writer.finish();
+	return writer.out;
+}
+
+size_t Encoder::maxPayloadBits(const size_t *counters) const {
+	// the final states and the end marker
+	size_t bits = NumStates * table_log + 1;
+	for(size_t s = 0; s < NumSymbols; ++s) {
+		if(counters[s] == 0) continue;
+		bits += counters[s] * (table_log - (norm[s] > 1 ? highBit(norm[s] - 1) : 0));
+	}
+	return bits;
+}
+
+uint8_t *Encoder::encode(const uint8_t *data, size_t data_size, uint8_t *out) const {
+	huffman::BitWriter writer{out};
+
+	// the first state of a symbol is picked so it writes no bits
+	auto init = [&](uint8_t symbol) -> uint32_t {
+		const Transform &t = transforms[symbol];
+		const uint32_t nb_bits = (t.delta_nb_bits + (1 << 15)) >> 16;
+		const uint32_t value = (nb_bits << 16) - t.delta_nb_bits;
+		return state_table[static_cast<int32_t>(value >> nb_bits) + t.delta_find_state];
+	};
+	auto step = [&](uint32_t &state, uint8_t symbol) {
+		const Transform &t = transforms[symbol];
+		const uint32_t nb_bits = (state + t.delta_nb_bits) >> 16;
+		writer.put(state & ((1u << nb_bits) - 1), nb_bits);
+		state = state_table[static_cast<int32_t>(state >> nb_bits) + t.delta_find_state];
+	};
+
+	// the last NumStates symbols pick the first states. The symbols left
+	// over by whole rounds come before them and belong to the lowest states.
+	const size_t rest = data_size % NumStates;
+	uint32_t first[NumStates];
+	for(size_t j = 0; j < NumStates; ++j) {
+		first[(rest + j) % NumStates] = init(data[data_size - NumStates + j]);
+	}
+	uint32_t state0 = first[0];
+	uint32_t state1 = first[1];
+	uint32_t state2 = first[2];
+	uint32_t state3 = first[3];
+
+	size_t i = data_size - NumStates;
+	if(rest > 2) step(state2, data[--i]);
+	if(rest > 1) step(state1, data[--i]);
+	if(rest > 0) {
+		step(state0, data[--i]);
+		writer.flushWord();
+	}
+	while(i > 0) {
+		step(state3, data[--i]);
+		step(state2, data[--i]);
+		step(state1, data[--i]);
+		step(state0, data[--i]);
+		writer.flushWord();
+	}
+
+	// read back first: state0 to state3
+	const uint32_t mask = (1u << table_log) - 1;
+	writer.put(state3 & mask, table_log);
+	writer.put(state2 & mask, table_log);
+	writer.put(state1 & mask, table_log);
+	writer.put(state0 & mask, table_log);
+	writer.put(1, 1);
+	writer.flushWord();
+	writer.finish();
+	return writer.out;
+}
+
+const uint8_t *Decoder::readHeader(const uint8_t *p, const uint8_t *end) {
+	huffman::BitReader reader{p, end};
+	size_t bits = 0;
+	auto read = [&](uint32_t n) {
+		if(reader.count < static_cast<int32_t>(n)) reader.refill();
+		const uint32_t value = reader.peek(n);
+		reader.consume(n);
+		bits += n;
+		return value;
+	};
+
+	table_log = read(4) + MinTableLog;
+	if(table_log > MaxTableLog) return nullptr;
+	const uint32_t max_symbol = read(8);
+
+	uint16_t norm[NumSymbols] = {0};
+	uint32_t remaining = 1u << table_log;
+	for(uint32_t s = 0; s <= max_symbol && remaining > 0; ++s) {
+		const uint32_t n = read(bitWidth(remaining));
+		if(n > remaining) return nullptr;
+		norm[s] = static_cast<uint16_t>(n);
+		remaining -= n;
+		if(n == 0) {
+			uint32_t run;
+			do {
+				run = read(2);
+				s += run;
+			} while(run == 3);
+			if(s > max_symbol) return nullptr;
+		}
+	}
+	if(remaining != 0) return nullptr;
+
+	const size_t header_size = (bits + 7) / 8;
+	if(header_size > static_cast<size_t>(end - p)) return nullptr;
+
+	uint8_t symbols[1 << MaxTableLog];
+	spreadSymbols(norm, table_log, symbols);
+
+	// the k-th state of a symbol reads enough bits to get back to any state
+	// before it: nb_bits brings k up to the table size
+	const uint32_t total = 1u << table_log;
+	uint32_t next[NumSymbols];
+	std::copy(norm, norm + NumSymbols, next);
+	for(uint32_t u = 0; u < total; ++u) {
+		const uint8_t s = symbols[u];
+		const uint32_t k = next[s]++;
+		const uint32_t nb_bits = table_log - highBit(k);
+		entries[u] = {static_cast<uint16_t>((k << nb_bits) - total), s,
+			static_cast<uint8_t>(nb_bits)};
+	}
+	return p + header_size;
+}
+
+bool Decoder::decode(const uint8_t *p, const uint8_t *end, uint8_t *out, size_t count) const {
+	if(count < NumStates) return false;
+
+	BackwardReader reader;
+	if(!reader.init(p, end)) return false;
+	uint32_t state0 = reader.read(table_log);
+	uint32_t state1 = reader.read(table_log);
+	uint32_t state2 = reader.read(table_log);
+	uint32_t state3 = reader.read(table_log);
+	reader.reload();
+
+	auto step = [&](uint32_t &state) {
+		const DecodeEntry &entry = entries[state];
+		state = entry.new_state + reader.read(entry.nb_bits);
+		return entry.symbol;
+	};
+
+	// the last NumStates symbols are the final states, they read no bits
+	const size_t steps = count - NumStates;
+	const size_t rest = steps % NumStates;
+	size_t i = 0;
+	for(; i < steps - rest; i += 4) {
+		out[i] = step(state0);
+		out[i + 1] = step(state1);
+		out[i + 2] = step(state2);
+		out[i + 3] = step(state3);
+		reader.reload();
+	}
+	if(rest > 0) out[i++] = step(state0);
+	if(rest > 1) out[i++] = step(state1);
+	if(rest > 2) out[i++] = step(state2);
+
+	const uint32_t last[NumStates] = {state0, state1, state2, state3};
+	for(size_t j = 0; j < NumStates; ++j) out[steps + j] = entries[last[(rest + j) % NumStates]].symbol;
+
+	reader.reload();
+	return reader.finished();
+}
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include "HuffmanCoder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// tANS over byte symbols, the table driven coder of FSE: every symbol gets a
+// share of the 2^table_log states in proportion to its count, so codes are
+// not limited to whole bits. Symbols are encoded from the last to the first
+// and decoded forward, the bits are read back from the end of the stream.
+namespace fse
+{
+
+using huffman::NumSymbols;
+
+const uint32_t MinTableLog = 5;
+const uint32_t MaxTableLog = 12;
+
+// interleaved states, symbol i belongs to state i % NumStates. They do not
+// wait on each other's table lookups.
+const size_t NumStates = 4;
+
+// one code of every state between word flushes and reloads
+static_assert(NumStates * MaxTableLog + 7 <= 56, "a word has to hold a code per state");
+
+// table log, last symbol and the counts with their zero runs, byte padded
+const size_t MaxHeaderSize = (4 + 8 + NumSymbols * (MaxTableLog + 1 + 2) + 7) / 8;
+
+struct DecodeEntry
+{
+	uint16_t new_state;
+	uint8_t symbol;
+	uint8_t nb_bits;
+};
+
+// reads the bits of a stream in the reverse order they were written. The last
+// byte holds a 1 bit above the last written bit. Reads past the start give
+// garbage but never touch memory outside the stream.
+struct BackwardReader
+{
+	const uint8_t *start;
+	const uint8_t *p;
+	uint64_t buffer;
+	// bits used from the top of buffer
+	uint32_t consumed;
+
+	bool init(const uint8_t *begin, const uint8_t *end) {
+		const size_t size = end - begin;
+		if(size == 0 || end[-1] == 0) return false;
+
+		start = begin;
+		if(size >= sizeof(buffer)) {
+			p = end - sizeof(buffer);
+			memcpy(&buffer, p, sizeof(buffer));
+			consumed = 0;
+		} else {
+			p = begin;
+			buffer = 0;
+			memcpy(&buffer, begin, size);
+			consumed = static_cast<uint32_t>(sizeof(buffer) - size) * 8;
+		}
+		consumed += 8 - (31 - __builtin_clz(end[-1]));
+		return true;
+	}
+
+	// n is at most 32, 0 reads nothing
+	uint32_t read(uint32_t n) {
+		const uint64_t value = ((buffer << (consumed & 63)) >> 1) >> ((63 - n) & 63);
+		consumed += n;
+		return static_cast<uint32_t>(value);
+	}
+
+	// at least 57 bits are left unless the start is near
+	void reload() {
+		if(consumed > 64) return;
+		if(p - start >= static_cast<ptrdiff_t>(sizeof(buffer))) {
+			p -= consumed >> 3;
+			consumed &= 7;
+		} else if(p != start) {
+			const size_t bytes = std::min<size_t>(consumed >> 3, p - start);
+			p -= bytes;
+			consumed -= static_cast<uint32_t>(bytes * 8);
+		} else {
+			return;
+		}
+		memcpy(&buffer, p, sizeof(buffer));
+	}
+
+	// every bit was read, no more
+	bool finished() const { return p == start && consumed == 64; }
+};
+
+class Encoder {
+public:
+	// normalizes counters that sum to data_size, the table shrinks below
+	// max_table_log for small inputs. There has to be a symbol.
+	void build(const size_t *counters, size_t data_size, uint32_t max_table_log);
+
+	uint32_t tableLog() const { return table_log; }
+
+	// the normalized counts, at most MaxHeaderSize bytes
+	size_t headerSize() const;
+	uint8_t *writeHeader(uint8_t *out) const;
+
+	// the payload of symbols with these counters takes at most this many bits
+	size_t maxPayloadBits(const size_t *counters) const;
+
+	// at least NumStates symbols, the payload needs 8 bytes of slack after it
+	uint8_t *encode(const uint8_t *data, size_t data_size, uint8_t *out) const;
+
+private:
+	struct Transform
+	{
+		int32_t delta_find_state;
+		uint32_t delta_nb_bits;
+	};
+
+	uint32_t table_log{0};
+	uint32_t max_symbol{0};
+	uint16_t norm[NumSymbols]{};
+	Transform transforms[NumSymbols]{};
+	// next states, by symbol then state
+	uint16_t state_table[1 << MaxTableLog]{};
+};
+
+class Decoder {
+public:
+	// returns the end of the header, nullptr when it is broken
+	const uint8_t *readHeader(const uint8_t *p, const uint8_t *end);
+
+	// count symbols from the whole stream, at least NumStates, false unless
+	// the stream is used up exactly
+	bool decode(const uint8_t *p, const uint8_t *end, uint8_t *out, size_t count) const;
+
+private:
+	DecodeEntry entries[1 << MaxTableLog]{};
+	uint32_t table_log{0};
+};
+
+}
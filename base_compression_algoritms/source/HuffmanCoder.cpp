@@ -0,0 +1,237 @@
+#include "HuffmanCoder.h"
+
+#include <algorithm>
+
+namespace huffman
+{
+
+namespace
+{
+
+// code lengths of a Huffman code limited to MaxCodeLength, absent symbols get 0.
+// Returns the number of present symbols.
+size_t buildLengths(const size_t *counters, uint8_t *lengths) {
+	memset(lengths, 0, NumSymbols);
+
+	CodeType symbols[NumSymbols];
+	size_t num_symbols = 0;
+	for(size_t i = 0; i < NumSymbols; ++i) {
+		if(counters[i] != 0) symbols[num_symbols++] = static_cast<CodeType>(i);
+	}
+
+	if(num_symbols <= 1) {
+		if(num_symbols == 1) lengths[symbols[0]] = 1;
+		return num_symbols;
+	}
+
+	// sort by count, least frequent first
+	std::sort(symbols, symbols + num_symbols,
+		[&](CodeType s0, CodeType s1){ return counters[s0] < counters[s1]; });
+
+	// two queue construction: leaves are sorted and merged nodes are created
+	// in non decreasing order, so the two smallest are always at the fronts
+	size_t weights[NumSymbols * 2];
+	uint16_t parents[NumSymbols * 2];
+	for(size_t i = 0; i < num_symbols; ++i) weights[i] = counters[symbols[i]];
+
+	size_t leaf = 0;
+	size_t node = num_symbols;
+	size_t end = num_symbols;
+	auto pop = [&]() {
+		return (leaf < num_symbols && (node == end || weights[leaf] <= weights[node]))
+			? leaf++ : node++;
+	};
+	while(end < num_symbols * 2 - 1) {
+		size_t i0 = pop();
+		size_t i1 = pop();
+		weights[end] = weights[i0] + weights[i1];
+		parents[i0] = parents[i1] = static_cast<uint16_t>(end);
+		++end;
+	}
+
+	// depths from the root down, parents always come later
+	uint8_t depths[NumSymbols * 2];
+	depths[end - 1] = 0;
+	for(size_t i = end - 1; i-- > 0;) depths[i] = depths[parents[i]] + 1;
+
+	// clamp to MaxCodeLength, then bring the Kraft sum back to one by
+	// splitting shorter codes, like deflate encoders do
+	uint32_t num_codes[NumSymbols] = {0};
+	for(size_t i = 0; i < num_symbols; ++i) {
+		num_codes[std::min<uint8_t>(depths[i], MaxCodeLength)]++;
+	}
+
+	uint32_t total = 0;
+	for(uint8_t l = 1; l <= MaxCodeLength; ++l) total += num_codes[l] << (MaxCodeLength - l);
+
+	while(total > (1u << MaxCodeLength)) {
+		num_codes[MaxCodeLength]--;
+		for(uint8_t l = MaxCodeLength - 1; l > 0; --l) {
+			if(num_codes[l] != 0) {
+				num_codes[l]--;
+				num_codes[l + 1] += 2;
+				break;
+			}
+		}
+		total--;
+	}
+
+	// the least frequent symbols get the longest codes
+	size_t i = 0;
+	for(uint8_t l = MaxCodeLength; l > 0; --l) {
+		for(uint32_t c = num_codes[l]; c > 0; --c) lengths[symbols[i++]] = l;
+	}
+	return num_symbols;
+}
+
+// the low length bits of c in reverse order, length is at most 16
+inline uint32_t reverseBits(uint32_t c, uint8_t length) {
+	c = ((c & 0x5555) << 1) | ((c >> 1) & 0x5555);
+	c = ((c & 0x3333) << 2) | ((c >> 2) & 0x3333);
+	c = ((c & 0x0F0F) << 4) | ((c >> 4) & 0x0F0F);
+	c = ((c & 0x00FF) << 8) | ((c >> 8) & 0x00FF);
+	return c >> (16 - length);
+}
+
+// canonical codes, bit reversed so the first bit of a code is the lowest one.
+// Returns false when the lengths do not form a prefix code.
+bool buildCodes(const uint8_t *lengths, Code *codes) {
+	uint32_t num_codes[MaxCodeLength + 1] = {0};
+	for(size_t i = 0; i < NumSymbols; ++i) {
+		if(lengths[i] > MaxCodeLength) return false;
+		num_codes[lengths[i]]++;
+	}
+
+	uint32_t total = 0;
+	for(uint8_t l = 1; l <= MaxCodeLength; ++l) total += num_codes[l] << (MaxCodeLength - l);
+	if(total > (1u << MaxCodeLength)) return false;
+
+	uint32_t next[MaxCodeLength + 1];
+	uint32_t code = 0;
+	num_codes[0] = 0;
+	for(uint8_t l = 1; l <= MaxCodeLength; ++l) {
+		code = (code + num_codes[l - 1]) << 1;
+		next[l] = code;
+	}
+
+	for(size_t i = 0; i < NumSymbols; ++i) {
+		uint8_t length = lengths[i];
+		codes[i] = {length != 0 ? reverseBits(next[length]++, length) : 0, length};
+	}
+	return true;
+}
+
+// table indexed by the next table_bits of the stream
+void buildDecodeTable(const Code *codes, DecodeEntry *table, uint8_t table_bits) {
+	const uint32_t table_size = 1u << table_bits;
+	for(uint32_t i = 0; i < table_size; ++i) table[i] = {0, table_bits};
+
+	for(size_t s = 0; s < NumSymbols; ++s) {
+		const Code &code = codes[s];
+		if(code.length == 0) continue;
+		for(uint32_t i = code.bits; i < table_size; i += 1u << code.length) {
+			table[i] = {static_cast<CodeType>(s), code.length};
+		}
+	}
+}
+
+// lengths go two per byte, high nibble first
+uint8_t *writeNibbles(uint8_t *out, const uint8_t *values, size_t count) {
+	for(size_t i = 0; i < count; i += 2) {
+		*out++ = (values[i] << 4) | (i + 1 < count ? values[i + 1] : 0);
+	}
+	return out;
+}
+
+const uint8_t *readNibbles(const uint8_t *p, uint8_t *values, size_t count) {
+	for(size_t i = 0; i < count; i += 2) {
+		values[i] = *p >> 4;
+		if(i + 1 < count) values[i + 1] = *p & 0b00001111;
+		++p;
+	}
+	return p;
+}
+
+size_t lengthsHeaderSize(size_t num_symbols) {
+	if(num_symbols == 0) return 0;
+	return sizeof(uint8_t) + (num_symbols <= SparseSymbols
+		? num_symbols + (num_symbols + 1) / 2 : NumSymbols / 2);
+}
+
+}
+
+size_t Encoder::build(const size_t *counters) {
+	num_symbols = buildLengths(counters, lengths);
+	buildCodes(lengths, table);
+	return num_symbols;
+}
+
+bool Encoder::buildFromLengths(const uint8_t *code_lengths) {
+	if(!buildCodes(code_lengths, table)) return false;
+	memcpy(lengths, code_lengths, NumSymbols);
+	num_symbols = NumSymbols - std::count(lengths, lengths + NumSymbols, 0);
+	return true;
+}
+
+size_t Encoder::headerSize() const {
+	return lengthsHeaderSize(num_symbols);
+}
+
+size_t Encoder::payloadBits(const size_t *counters) const {
+	size_t bits = 0;
+	for(size_t i = 0; i < NumSymbols; ++i) bits += counters[i] * table[i].length;
+	return bits;
+}
+
+uint8_t *Encoder::writeHeader(uint8_t *out) const {
+	if(num_symbols == 0) return out;
+
+	*out++ = static_cast<uint8_t>(num_symbols - 1);
+	if(num_symbols <= SparseSymbols) {
+		uint8_t present[SparseSymbols];
+		size_t n = 0;
+		for(size_t i = 0; i < NumSymbols; ++i) {
+			if(lengths[i] == 0) continue;
+			*out++ = static_cast<uint8_t>(i);
+			present[n++] = lengths[i];
+		}
+		return writeNibbles(out, present, n);
+	}
+	return writeNibbles(out, lengths, NumSymbols);
+}
+
+const uint8_t *Decoder::readHeader(const uint8_t *p, const uint8_t *end) {
+	if(p >= end) return nullptr;
+
+	const size_t num_symbols = *p++ + 1;
+	if(static_cast<size_t>(end - p) < lengthsHeaderSize(num_symbols) - 1) return nullptr;
+
+	uint8_t lengths[NumSymbols];
+	if(num_symbols <= SparseSymbols) {
+		memset(lengths, 0, sizeof(lengths));
+		const uint8_t *symbols = p;
+		uint8_t present[SparseSymbols];
+		p = readNibbles(p + num_symbols, present, num_symbols);
+		for(size_t i = 0; i < num_symbols; ++i) {
+			if(present[i] == 0) return nullptr;
+			lengths[symbols[i]] = present[i];
+		}
+	} else {
+		p = readNibbles(p, lengths, NumSymbols);
+	}
+
+	return build(lengths) ? p : nullptr;
+}
+
+bool Decoder::build(const uint8_t *code_lengths) {
+	Code codes[NumSymbols];
+	if(!buildCodes(code_lengths, codes)) return false;
+
+	table_bits = *std::max_element(code_lengths, code_lengths + NumSymbols);
+	if(table_bits == 0) return false;
+
+	buildDecodeTable(codes, entries, table_bits);
+	return true;
+}
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "BitStream.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// canonical length limited Huffman codes over byte symbols. CompressorHuffman
+// codes whole blocks with it, other codecs their own symbol streams.
+namespace huffman
+{
+
+using CodeType = uint8_t;
+
+const size_t NumSymbols = 1 << (sizeof(CodeType) * 8);
+
+// longest code, also the widest single level decode table
+const uint8_t MaxCodeLength = 11;
+
+// a refill leaves at least 56 bits in the reader
+const int SymbolsPerRefill = 56 / MaxCodeLength;
+
+// headers with up to this many symbols list them with their lengths,
+// otherwise the lengths of all symbols are stored
+const size_t SparseSymbols = 84;
+
+// the dense header, sparse ones are smaller
+const size_t MaxHeaderSize = sizeof(uint8_t) + NumSymbols / 2;
+
+// header and payload of num_symbols coded symbols at most
+inline size_t maxCodedSize(size_t num_symbols) {
+	return MaxHeaderSize + (num_symbols * MaxCodeLength + 7) / 8;
+}
+
+struct Code
+{
+	uint32_t bits;
+	uint8_t length;
+};
+
+struct DecodeEntry
+{
+	CodeType code;
+	uint8_t length;
+};
+
+// LSB first writer, flushes whole bytes out of a 64-bit accumulator
+struct BitWriter : bitstream::Writer<bitstream::BitOrder::Lsb>
+{
+	using Writer::put;
+
+	void put(const Code &code) {
+		buffer |= uint64_t(code.bits) << count;
+		count += code.length;
+	}
+
+	// Checked writes byte by byte, otherwise four codes are collected
+	// per stored word and at least 8 bytes of slack are needed after the payload
+	template <bool Checked>
+	void encode(const Code *codes, const uint8_t *data, size_t data_size) {
+		size_t i = 0;
+		if(!Checked) {
+			for(; i + 4 <= data_size; i += 4) {
+				put(codes[data[i]]);
+				put(codes[data[i + 1]]);
+				put(codes[data[i + 2]]);
+				put(codes[data[i + 3]]);
+				flushWord();
+			}
+		}
+		for(; i < data_size; ++i) {
+			put(codes[data[i]]);
+			Checked ? flushBytes() : flushWord();
+		}
+	}
+};
+
+using BitReader = bitstream::Reader<bitstream::BitOrder::Lsb>;
+
+// the code of one stream of symbols, built from their counts
+class Encoder {
+public:
+	// returns the number of present symbols
+	size_t build(const size_t *counters);
+	// a code given by its lengths, false when they do not form a prefix code
+	bool buildFromLengths(const uint8_t *code_lengths);
+
+	// the code lengths, nothing for a stream without symbols
+	size_t headerSize() const;
+	uint8_t *writeHeader(uint8_t *out) const;
+
+	size_t payloadBits(const size_t *counters) const;
+
+	const Code *codes() const { return table; }
+	const Code &code(CodeType symbol) const { return table[symbol]; }
+	const uint8_t *codeLengths() const { return lengths; }
+
+private:
+	uint8_t lengths[NumSymbols];
+	Code table[NumSymbols];
+	size_t num_symbols{0};
+};
+
+class Decoder {
+public:
+	// returns the end of the header, nullptr when it is broken
+	const uint8_t *readHeader(const uint8_t *p, const uint8_t *end);
+	// false when the lengths do not form a prefix code
+	bool build(const uint8_t *code_lengths);
+
+	uint8_t tableBits() const { return table_bits; }
+
+	// the reader has to hold tableBits() bits
+	CodeType decodeShort(BitReader &reader) const {
+		const DecodeEntry &entry = entries[reader.peek(table_bits)];
+		reader.consume(entry.length);
+		return entry.code;
+	}
+
+	CodeType decode(BitReader &reader) const {
+		if(reader.count < static_cast<int32_t>(table_bits)) reader.refill();
+		return decodeShort(reader);
+	}
+
+private:
+	DecodeEntry entries[1 << MaxCodeLength];
+	uint8_t table_bits{0};
+};
+
+}
@@ -0,0 +1,166 @@
+#include "LZ77Parser.h"
+#include "CompressorLZ77.h"
+#include "SimdKernels.h"
+
+namespace lz77
+{
+
+namespace
+{
+
+const LevelParams Levels[CompressorLZ77::MaxLevel + 1] = {
+	{0, 0, 0, 0, false},
+	{4, 16, 8, 0, false},
+	{8, 32, 16, 0, false},
+	{16, 64, 32, 0, false},
+	{16, 64, UINT32_MAX, 1, false},
+	{32, 128, UINT32_MAX, 1, false},
+	{64, 256, UINT32_MAX, 2, false},
+	{64, 128, UINT32_MAX, 0, true},
+	{128, 256, UINT32_MAX, 0, true},
+	{256, 1024, UINT32_MAX, 0, true},
+};
+
+}
+
+const LevelParams &levelParams(int level) {
+	return Levels[std::max(CompressorLZ77::MinLevel, std::min(level, CompressorLZ77::MaxLevel))];
+}
+
+void MatchFinder::reset(const uint8_t *data, size_t data_size, uint32_t window_bits,
+	const LevelParams &params)
+{
+	// the previous data ends at the new base, head is only cleared when the
+	// stored positions would overflow
+	if(head.empty() || uint64_t(base) + this->data_size + data_size >= UINT32_MAX) {
+		head.assign(1 << HashBits, 0);
+		base = 0;
+	} else {
+		base += static_cast<uint32_t>(this->data_size);
+	}
+
+	this->data = data;
+	this->data_size = data_size;
+	this->params = &params;
+	next_insert = 0;
+	probes = 0;
+
+	max_offset = (size_t(1) << window_bits) - 1;
+
+	// no need for a ring larger than the data, prev is only read through head
+	size_t chain_size = 1;
+	while(chain_size < data_size && chain_size < (size_t(1) << window_bits)) chain_size <<= 1;
+	chain_mask = chain_size - 1;
+	if(prev.size() < chain_size) prev.resize(chain_size);
+}
+
+void MatchFinder::setDictionary(const uint8_t *content, size_t content_size) {
+	dictionary = content_size >= MinMatch ? content : nullptr;
+	dictionary_size = dictionary ? content_size : 0;
+	dictionary_head.clear();
+	dictionary_prev.clear();
+	if(!dictionary) return;
+
+	dictionary_head.assign(1 << HashBits, 0);
+	dictionary_prev.resize(dictionary_size);
+	for(size_t pos = 0; pos + MinMatch <= dictionary_size; ++pos) {
+		uint32_t &h = dictionary_head[hash(dictionary + pos)];
+		dictionary_prev[pos] = h;
+		h = static_cast<uint32_t>(pos + 1);
+	}
+}
+
+uint32_t MatchFinder::hash(const uint8_t *p) {
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 2654435761u) >> (32 - HashBits);
+}
+
+void MatchFinder::insert(size_t pos) {
+	if(pos + MinMatch > data_size) return;
+
+	uint32_t &h = head[hash(data + pos)];
+	prev[pos & chain_mask] = h;
+	h = static_cast<uint32_t>(base + pos + 1);
+}
+
+void MatchFinder::insertUpTo(size_t end) {
+	for(; next_insert < end; ++next_insert) insert(next_insert);
+}
+
+void MatchFinder::skip(size_t end) {
+	if(end <= next_insert) return;
+	if(end - next_insert > params->insert_limit) {
+		next_insert = end;
+	} else {
+		insertUpTo(end);
+	}
+}
+
+template <typename Callback>
+void MatchFinder::search(size_t pos, Callback callback) {
+	insertUpTo(pos);
+	if(pos + MinMatch > data_size) return;
+
+	const uint8_t *current = data + pos;
+	const size_t max_length = data_size - pos;
+	size_t best_length = MinMatch - 1;
+
+	const uint32_t h = hash(current);
+	uint32_t depth = params->search_depth;
+	uint32_t candidate = head[h];
+	for(; candidate > base && depth > 0; --depth) {
+		size_t match_pos = candidate - base - 1;
+		if(pos - match_pos > chain_mask) return;
+		candidate = prev[match_pos & chain_mask];
+		++probes;
+
+		// a longer match has to differ from the best one at its end
+		const uint8_t *match = data + match_pos;
+		if(match[best_length] != current[best_length]) continue;
+
+		size_t length = simd::matchLength(match, current, max_length);
+
+		if(length > best_length) {
+			best_length = length;
+			callback(Match{static_cast<PairType>(length), static_cast<PairType>(pos - match_pos)});
+			if(length == max_length || length >= params->nice_length) return;
+		}
+	}
+
+	// the rest of the depth goes to the dictionary, its matches end with it
+	if(!dictionary) return;
+	candidate = dictionary_head[h];
+	for(; candidate != 0 && depth > 0; --depth) {
+		size_t match_pos = candidate - 1;
+		size_t offset = pos + dictionary_size - match_pos;
+		if(offset > max_offset) return;
+		candidate = dictionary_prev[match_pos];
+		++probes;
+
+		const size_t limit = std::min(max_length, dictionary_size - match_pos);
+		const uint8_t *match = dictionary + match_pos;
+		if(limit <= best_length || match[best_length] != current[best_length]) continue;
+
+		size_t length = simd::matchLength(match, current, limit);
+
+		if(length > best_length) {
+			best_length = length;
+			callback(Match{static_cast<PairType>(length), static_cast<PairType>(offset)});
+			if(length == max_length || length >= params->nice_length) return;
+		}
+	}
+}
+
+void MatchFinder::find(size_t pos, Token &out) {
+	Match best{0, 0};
+	search(pos, [&](const Match &match) { best = match; });
+	makeToken(data, data_size, pos, best, out);
+}
+
+size_t MatchFinder::findAll(size_t pos, Match *out) {
+	size_t count = 0;
+	search(pos, [&](const Match &match) { out[count++] = match; });
+	return count;
+}
+
+}
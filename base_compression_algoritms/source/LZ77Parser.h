@@ -0,0 +1,261 @@
+#pragma once
+#include "ScratchArena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// match finding and parsing shared by the LZ77 codecs. A parse is a sequence
+// of tokens, each one a match (possibly empty) followed by a literal.
+namespace lz77
+{
+
+using PairType = uint32_t;
+
+// shortest match the finder indexes
+const size_t MinMatch = 3;
+const uint32_t HashBits = 15;
+
+struct Token {
+	PairType offset;
+	PairType length;
+	uint8_t next;
+};
+
+struct LevelParams {
+	// hash chain candidates checked per position
+	uint32_t search_depth;
+	// a match this long ends the search and is taken as is
+	uint32_t nice_length;
+	// positions inside longer matches are not indexed
+	uint32_t insert_limit;
+	// how many following positions lazy matching tries
+	uint8_t lazy_steps;
+	bool optimal;
+};
+
+// parameters of a compression level, clamped to the valid levels
+const LevelParams &levelParams(int level);
+
+struct Match {
+	PairType length;
+	PairType offset;
+};
+
+// hash chains: head holds the latest position of every hash of MinMatch bytes,
+// prev links each position to the previous one with the same hash.
+// Positions are stored + base + 1, values up to base end a chain. The tables
+// are kept between calls, moving base past the last data empties them.
+// A dictionary is indexed once in tables of its own, its chains are searched
+// after the ones of the data as if it came right before the data.
+class MatchFinder {
+public:
+	// starts on new data
+	void reset(const uint8_t *data, size_t data_size, uint32_t window_bits,
+		const LevelParams &params);
+
+	// content every later data can match into, nullptr or 0 bytes for none
+	void setDictionary(const uint8_t *content, size_t content_size);
+
+	// the longest match at pos, positions before pos are indexed first
+	void find(size_t pos, Token &out);
+	// every match longer than the previous one, nearest first. out needs room for
+	// search_depth matches, returns their count.
+	size_t findAll(size_t pos, Match *out);
+	// positions up to end are covered by a match, long ones are not indexed
+	void skip(size_t end);
+
+	const uint8_t *getData() const { return data; }
+	size_t getDataSize() const { return data_size; }
+	// chain candidates compared since the last reset
+	size_t getProbes() const { return probes; }
+
+private:
+	static uint32_t hash(const uint8_t *p);
+	void insert(size_t pos);
+	void insertUpTo(size_t end);
+
+	template <typename Callback>
+	void search(size_t pos, Callback callback);
+
+	const uint8_t *data{nullptr};
+	size_t data_size{0};
+	const LevelParams *params{nullptr};
+	// next position to index
+	size_t next_insert{0};
+	// ring of prev links, also the window: offsets stay below its size
+	size_t chain_mask{0};
+	// longest offset of the window
+	size_t max_offset{0};
+	uint32_t base{0};
+	size_t probes{0};
+	std::vector<uint32_t> head;
+	std::vector<uint32_t> prev;
+
+	// positions + 1 in the dictionary, 0 ends a chain
+	const uint8_t *dictionary{nullptr};
+	size_t dictionary_size{0};
+	std::vector<uint32_t> dictionary_head;
+	std::vector<uint32_t> dictionary_prev;
+};
+
+// copies a match that starts offset bytes back from out, which is before data
+// and in the dictionary right in front of it. It may run on into data.
+inline void copyDictionaryMatch(uint8_t *&out, const uint8_t *data, const uint8_t *dictionary,
+	size_t dictionary_size, size_t offset, size_t length) {
+	const size_t back = offset - (out - data);
+	const size_t from_dictionary = std::min(back, length);
+	memcpy(out, dictionary + dictionary_size - back, from_dictionary);
+	for(size_t i = from_dictionary; i < length; ++i) out[i] = out[i - offset];
+	out += length;
+}
+
+// the match and the next symbol after it, the last token may have no next
+inline void makeToken(const uint8_t *data, size_t data_size, size_t pos, const Match &match,
+	Token &token) {
+	token.offset = match.offset;
+	token.length = match.length;
+	token.next = pos + match.length < data_size ? data[pos + match.length] : '\0';
+}
+
+// greedy when lazy_steps is 0, otherwise a literal is emitted while one of the
+// following positions has a longer match
+template <typename Emit>
+bool parseLazy(MatchFinder &finder, const LevelParams &params, Emit emit) {
+	const uint8_t *data = finder.getData();
+	const size_t data_size = finder.getDataSize();
+
+	Token token;
+	Token lazy;
+	for(size_t i = 0; i < data_size; ++i) {
+		finder.find(i, token);
+
+		for(uint8_t step = 1; step <= params.lazy_steps; ++step) {
+			if(token.length == 0 || token.length >= params.nice_length) break;
+			if(i + step >= data_size) break;
+
+			finder.find(i + step, lazy);
+			// a further position has to pay for the extra literals
+			if(lazy.length <= token.length + step - 1) continue;
+
+			for(uint8_t s = 0; s < step; ++s) {
+				makeToken(data, data_size, i + s, {0, 0}, token);
+				if(!emit(token)) return false;
+			}
+			i += step;
+			token = lazy;
+			step = 0;
+		}
+
+		finder.skip(std::min(i + token.length + 1, data_size));
+		if(!emit(token)) return false;
+		i += token.length;
+	}
+	return true;
+}
+
+const size_t OptimalChunk = 1 << 12;
+
+// Prices gives the bits of a token without a match, token(), and what a match of
+// length(l) at offset(d) adds to it
+// shortest path over the token prices inside chunks of OptimalChunk positions.
+// A match of nice_length or more ends the chunk and is taken directly.
+template <typename Prices, typename Emit>
+bool parseOptimal(MatchFinder &finder, ScratchArena &scratch, const LevelParams &params,
+	const Prices &prices, Emit emit) {
+	const uint8_t *data = finder.getData();
+	const size_t data_size = finder.getDataSize();
+
+	struct Step {
+		uint32_t price;
+		PairType length;
+		PairType offset;
+		// positions the token covers, 0 for unreached
+		PairType size;
+	};
+	Step *steps = scratch.allocate<Step>(OptimalChunk + 1);
+	Match *matches = scratch.allocate<Match>(params.search_depth);
+	Token *path = scratch.allocate<Token>(OptimalChunk);
+	size_t num_matches = 0;
+
+	Token token;
+	size_t pos = 0;
+	while(pos < data_size) {
+		const size_t chunk_end = std::min(pos + OptimalChunk, data_size);
+		const size_t chunk_size = chunk_end - pos;
+		for(size_t k = 0; k <= chunk_size; ++k) steps[k] = {UINT32_MAX, 0, 0, 0};
+		steps[0].price = 0;
+
+		auto relax = [&](size_t from, size_t to, uint32_t price, const Match &match) {
+			price += steps[from].price;
+			if(price < steps[to].price) steps[to] = {price, match.length, match.offset,
+				static_cast<PairType>(to - from)};
+		};
+
+		size_t target = chunk_size;
+		bool forced = false;
+		for(size_t k = 0; k < chunk_size; ++k) {
+			const size_t p = pos + k;
+			relax(k, k + 1, prices.token(), {0, 0});
+
+			num_matches = finder.findAll(p, matches);
+			if(num_matches == 0) continue;
+
+			const Match &longest = matches[num_matches - 1];
+			if(longest.length >= params.nice_length) {
+				target = k;
+				forced = true;
+				break;
+			}
+
+			PairType length = MinMatch;
+			for(size_t m = 0; m < num_matches; ++m) {
+				const Match &match = matches[m];
+				uint32_t offset_price = prices.token() + prices.offset(match.offset);
+				for(; length <= match.length; ++length) {
+					// the token ends with a literal unless it ends the data
+					size_t to = p + length == data_size ? k + length : k + length + 1;
+					if(to > chunk_size) break;
+					relax(k, to, offset_price + prices.length(length), {length, match.offset});
+				}
+			}
+		}
+
+		// walk back from the target
+		size_t path_size = 0;
+		for(size_t k = target; k > 0; k -= steps[k].size) {
+			const Step &step = steps[k];
+			size_t from = k - step.size;
+			makeToken(data, data_size, pos + from, {step.length, step.offset}, path[path_size++]);
+		}
+		for(size_t i = path_size; i-- > 0;) {
+			if(!emit(path[i])) return false;
+		}
+
+		pos += target;
+		if(forced) {
+			makeToken(data, data_size, pos, matches[num_matches - 1], token);
+			if(!emit(token)) return false;
+			pos = std::min(pos + token.length + 1, data_size);
+			finder.skip(pos);
+		}
+	}
+	return true;
+}
+
+// parses the data with a level, emit gets the tokens in order and stops the
+// parse by returning false.
+// The finder keeps its tables for the next call, the optimal parser takes its
+// buffers from scratch.
+template <typename Prices, typename Emit>
+bool parse(MatchFinder &finder, ScratchArena &scratch, const uint8_t *data, size_t data_size,
+	int level, uint32_t window_bits, const Prices &prices, Emit emit) {
+	const LevelParams &params = levelParams(level);
+	finder.reset(data, data_size, window_bits, params);
+	if(params.optimal) return parseOptimal(finder, scratch, params, prices, emit);
+	return parseLazy(finder, params, emit);
+}
+
+}
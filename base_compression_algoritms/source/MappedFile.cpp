@@ -0,0 +1,72 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() {
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::openRead(const char *path) {
+	if(isOpen() || !path) return false;
+
+	fd = ::open(path, O_RDONLY);
+	if(fd < 0) return false;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || !mapFile(static_cast<size_t>(info.st_size), false)) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::openWrite(const char *path, size_t size) {
+	if(isOpen() || !path) return false;
+
+	fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) return false;
+
+	if(ftruncate(fd, static_cast<off_t>(size)) != 0 || !mapFile(size, true)) {
+		close(0);
+		return false;
+	}
+	return true;
+}
+
+bool MappedFile::mapFile(size_t size, bool write) {
+	writable = write;
+	map_size = size;
+	// empty files can not be mapped, they have nothing to read or write
+	if(size == 0) return true;
+
+	void *address = mmap(nullptr, size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+		fd, 0);
+	if(address == MAP_FAILED) return false;
+
+	map = static_cast<uint8_t *>(address);
+	madvise(map, size, MADV_SEQUENTIAL);
+	return true;
+}
+
+bool MappedFile::close(size_t final_size) {
+	if(!isOpen()) return false;
+
+	bool ok = true;
+	if(map) ok = munmap(map, map_size) == 0;
+	if(writable && final_size != map_size) {
+		ok = ok && final_size <= map_size && ftruncate(fd, static_cast<off_t>(final_size)) == 0;
+	}
+	ok = ::close(fd) == 0 && ok;
+
+	fd = -1;
+	map = nullptr;
+	map_size = 0;
+	writable = false;
+	return ok;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// a whole file mapped into memory, unmapped when closed or destroyed
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// maps an existing file read only, the kernel is told it is read sequentially
+	bool openRead(const char *path);
+	// creates or truncates the file to size bytes and maps it writable.
+	// Pages are only allocated when written, the size can be an upper bound.
+	bool openWrite(const char *path, size_t size);
+
+	// a written file is cut to final_size, the mapping is released either way
+	bool close(size_t final_size);
+	bool close() { return close(map_size); }
+
+	const uint8_t *data() const { return map; }
+	// null for files opened for reading
+	uint8_t *writableData() { return writable ? map : nullptr; }
+	size_t size() const { return map_size; }
+	bool isOpen() const { return fd >= 0; }
+
+private:
+	bool mapFile(size_t size, bool write);
+
+	int fd{-1};
+	uint8_t *map{nullptr};
+	size_t map_size{0};
+	bool writable{false};
+};
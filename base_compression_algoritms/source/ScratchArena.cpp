@@ -0,0 +1,35 @@
+#include "ScratchArena.h"
+
+#include <algorithm>
+
+namespace
+{
+
+const size_t MinBlockSize = 1 << 12;
+
+}
+
+void ScratchArena::reset() {
+	used = 0;
+	if(blocks.size() <= 1) return;
+
+	// one block for everything the last call needed
+	blocks.clear();
+	blocks.emplace_back(new uint8_t[total_size]);
+	block_size = total_size;
+}
+
+void *ScratchArena::allocateBytes(size_t size, size_t align) {
+	// blocks come from new[], aligned for any fundamental type
+	size_t begin = (used + align - 1) & ~(align - 1);
+	if(blocks.empty() || begin + size > block_size) {
+		// at least doubles the arena
+		block_size = std::max(size, std::max(MinBlockSize, total_size));
+		blocks.emplace_back(new uint8_t[block_size]);
+		total_size += block_size;
+		begin = 0;
+	}
+
+	used = begin + size;
+	return blocks.back().get() + begin;
+}
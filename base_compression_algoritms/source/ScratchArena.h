@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// bump allocator for the scratch memory of one call. Nothing is freed one by
+// one: reset() makes the whole arena free again and merges what the last call
+// took into a single block, so repeated calls of the same size do not allocate.
+class ScratchArena {
+public:
+	// uninitialized room for count objects
+	template <typename T>
+	T *allocate(size_t count) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+		return static_cast<T *>(allocateBytes(sizeof(T) * count, alignof(T)));
+	}
+
+	void reset();
+
+	size_t capacity() const { return total_size; }
+
+private:
+	void *allocateBytes(size_t size, size_t align);
+
+	// allocations bump through the last block, earlier ones are full
+	std::vector<std::unique_ptr<uint8_t[]>> blocks;
+	size_t total_size{0};
+	size_t block_size{0};
+	size_t used{0};
+};
@@ -0,0 +1,192 @@
+#include "SimdKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace
+{
+
+// counts of a chunk this long fit the 32-bit sub-tables
+const size_t HistogramChunk = size_t(1) << 30;
+
+// the count of a repeated byte is spread over four tables, so consecutive
+// increments do not wait on each other through store to load forwarding
+void histogramTables(const uint8_t *data, size_t data_size, size_t *counters) {
+	uint32_t tables[4][256];
+
+	while(data_size > 0) {
+		size_t chunk = data_size < HistogramChunk ? data_size : HistogramChunk;
+		memset(tables, 0, sizeof(tables));
+
+		const uint8_t *p = data;
+		const uint8_t *end = data + chunk;
+		for(; end - p >= 8; p += 8) {
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			tables[0][v & 0xff]++;
+			tables[1][(v >> 8) & 0xff]++;
+			tables[2][(v >> 16) & 0xff]++;
+			tables[3][(v >> 24) & 0xff]++;
+			tables[0][(v >> 32) & 0xff]++;
+			tables[1][(v >> 40) & 0xff]++;
+			tables[2][(v >> 48) & 0xff]++;
+			tables[3][v >> 56]++;
+		}
+		for(; p < end; ++p) tables[0][*p]++;
+
+		for(size_t i = 0; i < 256; ++i) {
+			counters[i] += size_t(tables[0][i]) + tables[1][i] + tables[2][i] + tables[3][i];
+		}
+
+		data += chunk;
+		data_size -= chunk;
+	}
+}
+
+size_t matchLengthScalar(const uint8_t *a, const uint8_t *b, size_t max_length) {
+	size_t length = 0;
+	for(; max_length - length >= 8; length += 8) {
+		uint64_t va, vb;
+		memcpy(&va, a + length, sizeof(va));
+		memcpy(&vb, b + length, sizeof(vb));
+		if(uint64_t diff = va ^ vb) return length + (__builtin_ctzll(diff) >> 3);
+	}
+	while(length < max_length && a[length] == b[length]) ++length;
+	return length;
+}
+
+// reflected Castagnoli polynomial
+const uint32_t Crc32cPolynomial = 0x82f63b78;
+
+struct Crc32cTable {
+	uint32_t entries[256];
+
+	Crc32cTable() {
+		for(uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for(int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (Crc32cPolynomial & (0 - (crc & 1)));
+			entries[i] = crc;
+		}
+	}
+};
+
+uint32_t crc32cScalar(uint32_t crc, const uint8_t *data, size_t data_size) {
+	static const Crc32cTable table;
+	crc = ~crc;
+	for(size_t i = 0; i < data_size; ++i) crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+#ifdef SIMD_X86
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t data_size) {
+	uint64_t value = ~crc;
+	const uint8_t *end = data + data_size;
+#ifdef __x86_64__
+	for(; end - data >= 8; data += 8) {
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		value = _mm_crc32_u64(value, word);
+	}
+#endif
+	uint32_t value32 = static_cast<uint32_t>(value);
+	for(; data < end; ++data) value32 = _mm_crc32_u8(value32, *data);
+	return ~value32;
+}
+
+__attribute__((target("sse2")))
+size_t matchLengthSse2(const uint8_t *a, const uint8_t *b, size_t max_length) {
+	size_t length = 0;
+	for(; max_length - length >= 16; length += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + length));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + length));
+		uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+		if(equal != 0xffff) return length + __builtin_ctz(~equal);
+	}
+	return length + matchLengthScalar(a + length, b + length, max_length - length);
+}
+
+__attribute__((target("avx2")))
+size_t matchLengthAvx2(const uint8_t *a, const uint8_t *b, size_t max_length) {
+	size_t length = 0;
+	for(; max_length - length >= 32; length += 32) {
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + length));
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + length));
+		uint32_t equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+		if(equal != 0xffffffff) return length + __builtin_ctz(~equal);
+	}
+	return length + matchLengthSse2(a + length, b + length, max_length - length);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t matchLengthAvx512(const uint8_t *a, const uint8_t *b, size_t max_length) {
+	size_t length = 0;
+	for(; max_length - length >= 64; length += 64) {
+		__m512i va = _mm512_loadu_si512(a + length);
+		__m512i vb = _mm512_loadu_si512(b + length);
+		uint64_t differ = _mm512_cmpneq_epi8_mask(va, vb);
+		if(differ != 0) return length + __builtin_ctzll(differ);
+	}
+	return length + matchLengthAvx2(a + length, b + length, max_length - length);
+}
+
+#endif
+
+struct Kernels {
+	const char *name;
+	size_t (*match_length)(const uint8_t *, const uint8_t *, size_t);
+	uint32_t (*crc32c)(uint32_t, const uint8_t *, size_t);
+};
+
+Kernels selectKernels() {
+	Kernels selected{"scalar", matchLengthScalar, crc32cScalar};
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512bw")) {
+		selected.name = "avx512";
+		selected.match_length = matchLengthAvx512;
+	} else if(__builtin_cpu_supports("avx2")) {
+		selected.name = "avx2";
+		selected.match_length = matchLengthAvx2;
+	} else if(__builtin_cpu_supports("sse2")) {
+		selected.name = "sse2";
+		selected.match_length = matchLengthSse2;
+	}
+	// the crc instruction came with SSE 4.2
+	if(__builtin_cpu_supports("sse4.2")) selected.crc32c = crc32cSse42;
+#endif
+	return selected;
+}
+
+const Kernels &kernels() {
+	static const Kernels selected = selectKernels();
+	return selected;
+}
+
+}
+
+namespace simd
+{
+
+const char *variantName() {
+	return kernels().name;
+}
+
+// byte histograms gain nothing from vector registers, so they are not
+// dispatched. Scatter instructions serialize on repeated bytes.
+void histogram(const uint8_t *data, size_t data_size, size_t *counters) {
+	histogramTables(data, data_size, counters);
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t data_size) {
+	return kernels().crc32c(crc, data, data_size);
+}
+
+size_t matchLengthWide(const uint8_t *a, const uint8_t *b, size_t max_length) {
+	return kernels().match_length(a, b, max_length);
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// hot loops shared by the compressors. For match lengths and CRC-32C the widest
+// variant the CPU supports is picked once at startup, so one binary runs on
+// every x86-64 machine. The histogram is the same scalar code everywhere.
+namespace simd
+{
+
+// name of the selected match length variant: "scalar", "sse2", "avx2" or "avx512"
+const char *variantName();
+
+// adds the number of occurrences of every byte value to counters[256]
+void histogram(const uint8_t *data, size_t data_size, size_t *counters);
+
+// CRC-32C (Castagnoli) of data continuing from crc, start with 0
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t data_size);
+
+// length of the common prefix, dispatched past the first 8 bytes
+size_t matchLengthWide(const uint8_t *a, const uint8_t *b, size_t max_length);
+
+// length of the common prefix of a and b, at most max_length.
+// Most matches are short, so the first word is compared inline.
+inline size_t matchLength(const uint8_t *a, const uint8_t *b, size_t max_length) {
+	if(max_length >= sizeof(uint64_t)) {
+		uint64_t va, vb;
+		memcpy(&va, a, sizeof(va));
+		memcpy(&vb, b, sizeof(vb));
+		if(uint64_t diff = va ^ vb) return __builtin_ctzll(diff) >> 3;
+		return sizeof(uint64_t) + matchLengthWide(a + sizeof(uint64_t), b + sizeof(uint64_t),
+			max_length - sizeof(uint64_t));
+	}
+
+	size_t length = 0;
+	while(length < max_length && a[length] == b[length]) ++length;
+	return length;
+}
+
+}
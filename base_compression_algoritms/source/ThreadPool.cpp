@@ -0,0 +1,140 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace
+{
+
+inline uint64_t packRange(uint32_t begin, uint32_t end) {
+	return (uint64_t(end) << 32) | begin;
+}
+
+inline uint32_t rangeBegin(uint64_t range) {
+	return static_cast<uint32_t>(range);
+}
+
+inline uint32_t rangeEnd(uint64_t range) {
+	return static_cast<uint32_t>(range >> 32);
+}
+
+}
+
+ThreadPool::ThreadPool(size_t num_threads) {
+	if(num_threads == 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+	num_workers = num_threads;
+	slices.reset(new Slice[num_workers]);
+
+	threads.reserve(num_workers - 1);
+	for(size_t worker = 1; worker < num_workers; ++worker) {
+		threads.emplace_back([this, worker] { workerLoop(worker); });
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for(std::thread &thread : threads) thread.join();
+}
+
+void ThreadPool::parallelFor(size_t count, const Task &task) {
+	if(count == 0) return;
+
+	// indices are 32 bit, larger ranges are run in rounds
+	const size_t MaxRound = UINT32_MAX;
+	if(count > MaxRound) {
+		for(size_t first = 0; first < count; first += MaxRound) {
+			size_t round = std::min(MaxRound, count - first);
+			parallelFor(round, [&](size_t index, size_t worker) { task(first + index, worker); });
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> call_lock(call_mutex);
+
+	if(num_workers == 1 || count == 1) {
+		for(size_t i = 0; i < count; ++i) task(i, 0);
+		return;
+	}
+
+	for(size_t worker = 0; worker < num_workers; ++worker) {
+		uint32_t begin = static_cast<uint32_t>(count * worker / num_workers);
+		uint32_t end = static_cast<uint32_t>(count * (worker + 1) / num_workers);
+		slices[worker].range.store(packRange(begin, end), std::memory_order_relaxed);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->task = &task;
+		running = num_workers - 1;
+		++generation;
+	}
+	wake.notify_all();
+
+	run(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return running == 0; });
+	this->task = nullptr;
+}
+
+bool ThreadPool::popLocal(size_t worker, size_t &index) {
+	std::atomic<uint64_t> &range = slices[worker].range;
+	uint64_t current = range.load(std::memory_order_acquire);
+	for(;;) {
+		uint32_t begin = rangeBegin(current);
+		uint32_t end = rangeEnd(current);
+		if(begin >= end) return false;
+		if(range.compare_exchange_weak(current, packRange(begin + 1, end),
+			std::memory_order_acq_rel)) {
+			index = begin;
+			return true;
+		}
+	}
+}
+
+bool ThreadPool::steal(size_t worker, size_t &index) {
+	for(size_t i = 1; i < num_workers; ++i) {
+		std::atomic<uint64_t> &range = slices[(worker + i) % num_workers].range;
+		uint64_t current = range.load(std::memory_order_acquire);
+		for(;;) {
+			uint32_t begin = rangeBegin(current);
+			uint32_t end = rangeEnd(current);
+			if(begin >= end) break;
+
+			uint32_t middle = begin + (end - begin) / 2;
+			if(range.compare_exchange_weak(current, packRange(begin, middle),
+				std::memory_order_acq_rel)) {
+				// our own slice is empty, nobody else takes from it now
+				slices[worker].range.store(packRange(middle + 1, end), std::memory_order_release);
+				index = middle;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void ThreadPool::run(size_t worker) {
+	size_t index;
+	while(popLocal(worker, index) || steal(worker, index)) (*task)(index, worker);
+}
+
+void ThreadPool::workerLoop(size_t worker) {
+	uint64_t seen = 0;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stop || generation != seen; });
+			if(stop) return;
+			seen = generation;
+		}
+
+		run(worker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if(--running == 0) done.notify_one();
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// fixed set of workers running index ranges. Every worker owns a slice of the
+// range and, once it is done, steals half of what is left in another slice.
+class ThreadPool {
+public:
+	// worker is in [0, size()), the calling thread works as worker 0
+	using Task = std::function<void(size_t index, size_t worker)>;
+
+	// 0 uses every hardware thread
+	explicit ThreadPool(size_t num_threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	size_t size() const { return num_workers; }
+
+	// runs task for every index in [0, count) and returns when all are done.
+	// Calls from several threads are run one after another.
+	void parallelFor(size_t count, const Task &task);
+
+private:
+	// [begin, end) packed into one word, the owner takes from the front,
+	// thieves cut off the back
+	struct alignas(64) Slice {
+		std::atomic<uint64_t> range{0};
+	};
+
+	bool popLocal(size_t worker, size_t &index);
+	bool steal(size_t worker, size_t &index);
+	void run(size_t worker);
+	void workerLoop(size_t worker);
+
+	size_t num_workers;
+	std::unique_ptr<Slice[]> slices;
+	std::vector<std::thread> threads;
+
+	std::mutex call_mutex;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const Task *task{nullptr};
+	uint64_t generation{0};
+	size_t running{0};
+	bool stop{false};
+};
@@ -0,0 +1,383 @@
+#include "CompressorAuto.h"
+#include "CompressorFSE.h"
+#include "CompressorHuffman.h"
+#include "CompressorLZ77.h"
+#include "CompressorLZ77Huffman.h"
+#include "CompressorLZ78.h"
+#include "CompressorParallel.h"
+#include "Dictionary.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+// heap usage: every allocation carries its size in front of it
+namespace
+{
+
+const size_t AllocationHeader = alignof(std::max_align_t);
+
+std::atomic<size_t> heap_current{0};
+std::atomic<size_t> heap_peak{0};
+
+void *countedAlloc(size_t size) {
+	void *block = malloc(size + AllocationHeader);
+	if(!block) throw std::bad_alloc();
+
+	*static_cast<size_t *>(block) = size;
+	size_t current = heap_current += size;
+	size_t peak = heap_peak.load(std::memory_order_relaxed);
+	while(current > peak && !heap_peak.compare_exchange_weak(peak, current));
+	return static_cast<uint8_t *>(block) + AllocationHeader;
+}
+
+void countedFree(void *pointer) {
+	if(!pointer) return;
+
+	void *block = static_cast<uint8_t *>(pointer) - AllocationHeader;
+	heap_current -= *static_cast<size_t *>(block);
+	free(block);
+}
+
+}
+
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void *pointer) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer) noexcept { countedFree(pointer); }
+void operator delete(void *pointer, size_t) noexcept { countedFree(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { countedFree(pointer); }
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+enum class Format {
+	Text,
+	Csv,
+	Json
+};
+
+struct Options {
+	int runs{5};
+	int warmups{1};
+	Format format{Format::Text};
+	// only codecs whose name contains this
+	std::string filter;
+	// when set the files are cut into messages of this size, which are run
+	// through the batch calls on threads workers
+	size_t message_size{0};
+	size_t threads{1};
+	// set on every codec that takes it, the others are skipped
+	std::shared_ptr<const Dictionary> dictionary;
+	std::vector<std::string> paths;
+};
+
+struct Codec {
+	std::string name;
+	std::function<std::unique_ptr<Compressor>()> create;
+};
+
+struct Result {
+	std::string file;
+	std::string codec;
+	size_t data_size;
+	size_t compressed_size;
+	// MB/s, p99 is the speed of the 99th percentile run time
+	double compress_median;
+	double compress_p99;
+	double decompress_median;
+	double decompress_p99;
+	size_t compress_peak_heap;
+	size_t decompress_peak_heap;
+	bool ok;
+};
+
+std::vector<Codec> codecs() {
+	return {
+		{"huffman", [] { return std::make_unique<CompressorHuffman>(); }},
+		{"huffman-x4", [] { return std::make_unique<CompressorHuffman>(4); }},
+		{"fse", [] { return std::make_unique<CompressorFSE>(); }},
+		{"lz77-1", [] { return std::make_unique<CompressorLZ77>(1); }},
+		{"lz77-5", [] { return std::make_unique<CompressorLZ77>(5); }},
+		{"lz77-9", [] { return std::make_unique<CompressorLZ77>(9); }},
+		{"lz77h-5", [] { return std::make_unique<CompressorLZ77Huffman>(5); }},
+		{"lz77h-9", [] { return std::make_unique<CompressorLZ77Huffman>(9); }},
+		{"lz78", [] { return std::make_unique<CompressorLZ78>(); }},
+		{"lz78-12", [] {
+			return std::make_unique<CompressorLZ78>(CompressorLZ78::Mode::Phrase, 12);
+		}},
+		{"lzw", [] { return std::make_unique<CompressorLZ78>(CompressorLZ78::Mode::Lzw); }},
+		{"auto", [] { return std::make_unique<CompressorAuto>(); }},
+		{"parallel-lz77-5", [] {
+			return std::make_unique<CompressorParallel>(std::make_unique<CompressorLZ77>(5));
+		}},
+	};
+}
+
+// nearest rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, double p) {
+	size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.999999);
+	return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// runs op warmups + runs times, returns the throughput of the measured runs
+// in MB/s and the peak heap growth over all of them
+std::vector<double> measure(const Options &options, size_t data_size,
+	const std::function<bool()> &op, size_t &peak_heap, bool &ok)
+{
+	std::vector<double> speeds;
+	const size_t base = heap_current;
+	heap_peak = base;
+
+	for(int i = 0; i < options.warmups + options.runs; ++i) {
+		auto start = Clock::now();
+		ok = op() && ok;
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		if(i >= options.warmups) speeds.push_back(data_size / 1e6 / std::max(seconds, 1e-9));
+	}
+
+	peak_heap = heap_peak - base;
+	std::sort(speeds.begin(), speeds.end());
+	return speeds;
+}
+
+// the messages of data in the batch items, compressed ones are packed at bound
+// intervals in compressed, their decompressed copies go into decompressed
+void cutMessages(const Options &options, const Compressor &compressor, const uint8_t *data,
+	size_t data_size, std::vector<uint8_t> &compressed, std::vector<uint8_t> &decompressed,
+	std::vector<CompressorBatchItem> &items, std::vector<CompressorBatchItem> &compressed_items)
+{
+	const size_t bound = compressor.compressBound(options.message_size);
+	const size_t count = (data_size + options.message_size - 1) / options.message_size;
+	compressed.resize(std::max<size_t>(count * bound, 1));
+	items.resize(count);
+	compressed_items.resize(count);
+	for(size_t i = 0; i < count; ++i) {
+		const size_t offset = i * options.message_size;
+		const size_t size = std::min(options.message_size, data_size - offset);
+		items[i] = {data + offset, size, compressed.data() + i * bound, bound};
+		compressed_items[i] = {compressed.data() + i * bound, 0, decompressed.data() + offset, size};
+	}
+}
+
+Result runBatch(const Options &options, const std::string &path, const uint8_t *data,
+	size_t data_size, const Codec &codec, ThreadPool &pool)
+{
+	std::unique_ptr<Compressor> compressor = codec.create();
+	compressor->setDictionary(options.dictionary);
+
+	std::vector<uint8_t> compressed;
+	std::vector<uint8_t> decompressed(std::max<size_t>(data_size, 1));
+	std::vector<CompressorBatchItem> items;
+	std::vector<CompressorBatchItem> compressed_items;
+	cutMessages(options, *compressor, data, data_size, compressed, decompressed, items,
+		compressed_items);
+
+	Result result{path, codec.name, data_size, 0, 0, 0, 0, 0, 0, 0, true};
+
+	std::vector<double> speeds = measure(options, data_size, [&] {
+		return compressor->compressBatch(items.data(), items.size(), &pool);
+	}, result.compress_peak_heap, result.ok);
+	result.compress_median = percentile(speeds, 50);
+	result.compress_p99 = percentile(speeds, 1);
+
+	for(size_t i = 0; i < items.size(); ++i) {
+		compressed_items[i].data_size = items[i].result_size;
+		result.compressed_size += items[i].result_size;
+	}
+
+	speeds = measure(options, data_size, [&] {
+		return compressor->decompressBatch(compressed_items.data(), compressed_items.size(), &pool);
+	}, result.decompress_peak_heap, result.ok);
+	result.decompress_median = percentile(speeds, 50);
+	result.decompress_p99 = percentile(speeds, 1);
+
+	for(size_t i = 0; i < items.size(); ++i) {
+		result.ok = result.ok && compressed_items[i].result_size == items[i].data_size;
+	}
+	result.ok = result.ok && memcmp(data, decompressed.data(), data_size) == 0;
+	return result;
+}
+
+Result run(const Options &options, const std::string &path, const uint8_t *data,
+	size_t data_size, const Codec &codec)
+{
+	std::unique_ptr<Compressor> compressor = codec.create();
+	compressor->setDictionary(options.dictionary);
+
+	std::vector<uint8_t> compressed(compressor->compressBound(data_size));
+	std::vector<uint8_t> decompressed(std::max<size_t>(data_size, 1));
+
+	Result result{path, codec.name, data_size, 0, 0, 0, 0, 0, 0, 0, true};
+
+	std::vector<double> speeds = measure(options, data_size, [&] {
+		return compressor->compress(data, data_size, compressed.data(), compressed.size(),
+			result.compressed_size);
+	}, result.compress_peak_heap, result.ok);
+	result.compress_median = percentile(speeds, 50);
+	result.compress_p99 = percentile(speeds, 1);
+
+	size_t decompressed_size = 0;
+	speeds = measure(options, data_size, [&] {
+		return compressor->decompress(compressed.data(), result.compressed_size,
+			decompressed.data(), data_size, decompressed_size);
+	}, result.decompress_peak_heap, result.ok);
+	result.decompress_median = percentile(speeds, 50);
+	result.decompress_p99 = percentile(speeds, 1);
+
+	result.ok = result.ok && decompressed_size == data_size
+		&& memcmp(data, decompressed.data(), data_size) == 0;
+	return result;
+}
+
+void printResult(const Options &options, const Result &r, bool first) {
+	const double ratio = r.compressed_size > 0 ? double(r.data_size) / r.compressed_size : 0;
+	switch(options.format) {
+	case Format::Text:
+		printf("%-24s %-16s %10zu %8.3f %10.2f %10.2f %10.2f %10.2f %10zu %10zu %s\n",
+			std::filesystem::path(r.file).filename().string().c_str(), r.codec.c_str(),
+			r.data_size, ratio, r.compress_median, r.compress_p99, r.decompress_median,
+			r.decompress_p99, r.compress_peak_heap, r.decompress_peak_heap,
+			r.ok ? "ok" : "FAILED");
+		break;
+	case Format::Csv:
+		printf("%s,%s,%zu,%zu,%.4f,%.2f,%.2f,%.2f,%.2f,%zu,%zu,%d\n", r.file.c_str(),
+			r.codec.c_str(), r.data_size, r.compressed_size, ratio, r.compress_median,
+			r.compress_p99, r.decompress_median, r.decompress_p99, r.compress_peak_heap,
+			r.decompress_peak_heap, r.ok ? 1 : 0);
+		break;
+	case Format::Json:
+		printf("%s\n    {\"file\": \"%s\", \"codec\": \"%s\", \"size\": %zu, \"compressed_size\": %zu, "
+			"\"ratio\": %.4f, \"compress_mbs_median\": %.2f, \"compress_mbs_p99\": %.2f, "
+			"\"decompress_mbs_median\": %.2f, \"decompress_mbs_p99\": %.2f, "
+			"\"compress_peak_heap\": %zu, \"decompress_peak_heap\": %zu, \"ok\": %s}",
+			first ? "" : ",", r.file.c_str(), r.codec.c_str(), r.data_size, r.compressed_size,
+			ratio, r.compress_median, r.compress_p99, r.decompress_median, r.decompress_p99,
+			r.compress_peak_heap, r.decompress_peak_heap, r.ok ? "true" : "false");
+		break;
+	}
+}
+
+void printHeader(const Options &options) {
+	switch(options.format) {
+	case Format::Text:
+		printf("%-24s %-16s %10s %8s %10s %10s %10s %10s %10s %10s\n", "file", "codec", "size",
+			"ratio", "comp MB/s", "comp p99", "dec MB/s", "dec p99", "comp heap", "dec heap");
+		break;
+	case Format::Csv:
+		printf("file,codec,size,compressed_size,ratio,compress_mbs_median,compress_mbs_p99,"
+			"decompress_mbs_median,decompress_mbs_p99,compress_peak_heap,decompress_peak_heap,ok\n");
+		break;
+	case Format::Json:
+		printf("{\"runs\": %d, \"warmups\": %d, \"results\": [", options.runs, options.warmups);
+		break;
+	}
+}
+
+void printFooter(const Options &options) {
+	if(options.format == Format::Json) printf("\n]}\n");
+}
+
+// files are taken as they are, directories for the files directly in them
+std::vector<std::string> collectFiles(const std::vector<std::string> &paths) {
+	std::vector<std::string> files;
+	for(const std::string &path : paths) {
+		std::error_code error;
+		if(std::filesystem::is_directory(path, error)) {
+			std::vector<std::string> directory;
+			for(const auto &entry : std::filesystem::directory_iterator(path, error)) {
+				if(entry.is_regular_file(error)) directory.push_back(entry.path().string());
+			}
+			std::sort(directory.begin(), directory.end());
+			files.insert(files.end(), directory.begin(), directory.end());
+		} else {
+			files.push_back(path);
+		}
+	}
+	return files;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--runs" && i + 1 < argc) {
+			options.runs = std::max(1, atoi(argv[++i]));
+		} else if(arg == "--warmup" && i + 1 < argc) {
+			options.warmups = std::max(0, atoi(argv[++i]));
+		} else if(arg == "--codec" && i + 1 < argc) {
+			options.filter = argv[++i];
+		} else if(arg == "--messages" && i + 1 < argc) {
+			options.message_size = std::max(1, atoi(argv[++i]));
+		} else if(arg == "--threads" && i + 1 < argc) {
+			options.threads = std::max(1, atoi(argv[++i]));
+		} else if(arg == "--dictionary" && i + 1 < argc) {
+			options.dictionary = Dictionary::loadFile(argv[++i]);
+			if(!options.dictionary) {
+				fprintf(stderr, "can not load the dictionary %s\n", argv[i]);
+				return false;
+			}
+		} else if(arg == "--csv") {
+			options.format = Format::Csv;
+		} else if(arg == "--json") {
+			options.format = Format::Json;
+		} else if(arg.size() > 1 && arg[0] == '-') {
+			return false;
+		} else {
+			options.paths.push_back(arg);
+		}
+	}
+	return !options.paths.empty();
+}
+
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if(!parseOptions(argc, argv, options)) {
+		fprintf(stderr, "usage: %s [--runs N] [--warmup N] [--codec NAME] [--csv | --json] "
+			"[--messages SIZE [--threads N]] [--dictionary PATH] FILE_OR_DIRECTORY...\n", argv[0]);
+		return 2;
+	}
+
+	ThreadPool pool(options.threads);
+	bool ok = true;
+	bool first = true;
+	printHeader(options);
+	for(const std::string &path : collectFiles(options.paths)) {
+		MappedFile file;
+		if(!file.openRead(path.c_str())) {
+			fprintf(stderr, "can not read %s\n", path.c_str());
+			ok = false;
+			continue;
+		}
+
+		static const uint8_t empty[1] = {};
+		const uint8_t *data = file.size() > 0 ? file.data() : empty;
+		for(const Codec &codec : codecs()) {
+			if(codec.name.find(options.filter) == std::string::npos) continue;
+			if(options.dictionary && !codec.create()->setDictionary(options.dictionary)) continue;
+
+			Result result = options.message_size > 0
+				? runBatch(options, path, data, file.size(), codec, pool)
+				: run(options, path, data, file.size(), codec);
+			printResult(options, result, first);
+			first = false;
+			ok = ok && result.ok;
+		}
+	}
+	printFooter(options);
+
+	return ok ? 0 : 1;
+}
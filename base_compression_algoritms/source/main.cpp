@@ -1,9 +1,19 @@
+#include "CompressorAuto.h"
+#include "CompressorFSE.h"
 #include "CompressorHuffman.h"
 #include "CompressorLZ77.h"
+#include "CompressorLZ77Huffman.h"
 #include "CompressorLZ78.h"
+#include "CompressorParallel.h"
+#include "Dictionary.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include <sys/time.h>
 
@@ -39,33 +49,75 @@ private:
 
 };
 
+// the counters that apply to the codec, the others stay 0
+void print_stats(const CompressorStats &stats) {
+	std::cout << "Header bytes: " << stats.header_bytes << std::endl;
+	if (stats.literals || stats.matches) {
+		std::cout << "Literals: " << stats.literals << ", matches: " << stats.matches
+			<< ", average length: " << stats.averageMatchLength() << std::endl;
+	}
+	if (stats.match_probes) {
+		std::cout << "Average offset: " << stats.averageMatchOffset()
+			<< ", probes per byte: " << stats.probesPerByte() << std::endl;
+	}
+	if (stats.dict_hits) {
+		std::cout << "Dictionary hits: " << stats.dict_hits
+			<< ", collisions: " << stats.dict_collisions << std::endl;
+	}
+	if (stats.coded_symbols) {
+		std::cout << "Coded symbols: " << stats.coded_symbols
+			<< ", average code length: " << stats.averageCodeLength() << std::endl;
+	}
+	if (stats.stored_blocks) {
+		std::cout << "Stored blocks: " << stats.stored_blocks << std::endl;
+	}
+}
+
 void test_compress_data(const uint8_t *data, size_t data_size, Compressor &compressor) {
 
 	std::cout << "--------------------------------------------------------------------------------" << std::endl;
 	std::cout << "Compressor: " << compressor.getTypeName() << std::endl;
 
-	uint8_t *compressed_data = new uint8_t[data_size * 8];
-	memset(compressed_data, 0, data_size * 4);
+	const size_t compressed_capacity = compressor.compressBound(data_size);
+	uint8_t *compressed_data = new uint8_t[compressed_capacity];
 
 	if (data_size < 128)
 		std::cout << "Source data: " << data << std::endl;;
 	std::cout << "Source data size: " << data_size << std::endl;;
 
 	size_t compressed_size;
+	CompressorStats stats;
+	compressor.setStats(&stats);
 	{
 		ScopeTimer timer("Compress time");
 		if (!compressor.compress(data, data_size, compressed_data,
-			data_size * 4, compressed_size)) {
+			compressed_capacity, compressed_size)) {
 			std::cerr << "compress failed." << std::endl;
 		}
 	}
+	compressor.setStats(nullptr);
 
 	std::cout << "Compressed data size: " << compressed_size << std::endl;
 	std::cout << "Ratio: " << float(data_size) / compressed_size << std::endl;
+	print_stats(stats);
+
+	// the checked paths: an exact buffer is enough, one byte less is not
+	{
+		std::vector<uint8_t> exact(std::max<size_t>(compressed_size, 1));
+		size_t exact_size;
+		if (!compressor.compress(data, data_size, exact.data(), compressed_size, exact_size)
+			|| exact_size != compressed_size
+			|| memcmp(exact.data(), compressed_data, compressed_size) != 0) {
+			std::cerr << "compress into an exact buffer failed." << std::endl;
+		}
+		if (compressed_size > 0
+			&& compressor.compress(data, data_size, exact.data(), compressed_size - 1, exact_size)) {
+			std::cerr << "compress into a short buffer succeeded." << std::endl;
+		}
+	}
 
 	uint8_t *decompressed_data = new uint8_t[data_size];
 	size_t decompressed_size = 0;
-	memset(decompressed_data, 0, data_size);
 
 	{
 		ScopeTimer timer("Decompress time");
@@ -90,24 +142,390 @@ void test_compress_data(const uint8_t *data, size_t data_size, Compressor &compr
 	delete[] decompressed_data;
 }
 
+// the output only depends on the input: A compresses the same before and
+// after the instance has seen B
+void test_deterministic(const uint8_t *a, size_t a_size, const uint8_t *b, size_t b_size,
+	Compressor &compressor) {
+
+	std::vector<uint8_t> first(compressor.compressBound(a_size));
+	std::vector<uint8_t> other(compressor.compressBound(b_size));
+	std::vector<uint8_t> again(first.size());
+	size_t first_size = 0;
+	size_t other_size = 0;
+	size_t again_size = 0;
+	if (!compressor.compress(a, a_size, first.data(), first.size(), first_size)
+		|| !compressor.compress(b, b_size, other.data(), other.size(), other_size)
+		|| !compressor.compress(a, a_size, again.data(), again.size(), again_size)
+		|| first_size != again_size || memcmp(first.data(), again.data(), first_size) != 0) {
+		std::cerr << compressor.getTypeName() << " output depends on earlier calls." << std::endl;
+	}
+}
+
 void test_compress_file(const char *filepath, Compressor &compressor) {
-	
+
+	MappedFile file;
+	if(!file.openRead(filepath)) {
+		return;
+	}
+
+	// empty files are not mapped
+	static const uint8_t empty[1] = {};
+	test_compress_data(file.size() > 0 ? file.data() : empty, file.size(), compressor);
+	std::cout << "File: " << filepath << std::endl;
+}
+
+void test_mapped_file(const char *filepath, Compressor &compressor) {
+
+	MappedFile file;
+	if(!file.openRead(filepath)) {
+		return;
+	}
+
+	std::cout << "--------------------------------------------------------------------------------" << std::endl;
+	std::cout << "Mapped file compressor: " << compressor.getTypeName() << std::endl;
+
+	const std::string compressed_path = std::string(filepath) + ".compressed";
+	const std::string decompressed_path = std::string(filepath) + ".decompressed";
+
+	bool ok;
+	{
+		ScopeTimer timer("Mapped file time");
+		ok = compressor.compressFile(filepath, compressed_path.c_str())
+			&& compressor.decompressFile(compressed_path.c_str(), decompressed_path.c_str());
+	}
+
+	MappedFile compressed;
+	MappedFile decompressed;
+	if(!ok || !compressed.openRead(compressed_path.c_str())
+		|| !decompressed.openRead(decompressed_path.c_str())) {
+		std::cerr << "mapped file failed." << std::endl;
+	} else {
+		std::cout << "Source data size: " << file.size() << std::endl;
+		std::cout << "Compressed data size: " << compressed.size() << std::endl;
+		if(decompressed.size() != file.size()
+			|| (file.size() > 0 && memcmp(file.data(), decompressed.data(), file.size()) != 0)) {
+			std::cerr << "Data corruption." << std::endl;
+		}
+	}
+
+	compressed.close();
+	decompressed.close();
+	remove(compressed_path.c_str());
+	remove(decompressed_path.c_str());
+}
+
+void test_stream_file(const char *filepath, Compressor &compressor) {
+
+	FILE *file = fopen(filepath, "rb");
+	FILE *check_file = fopen(filepath, "rb");
+	if(!file || !check_file) {
+		if(file) fclose(file);
+		if(check_file) fclose(check_file);
+		return;
+	}
+
+	std::cout << "--------------------------------------------------------------------------------" << std::endl;
+	std::cout << "Stream compressor: " << compressor.getTypeName() << std::endl;
+
+	size_t data_size = 0;
+	size_t compressed_size = 0;
+	size_t decompressed_size = 0;
+	bool corrupted = false;
+
+	// the compressed stream is piped into the decompressor and checked chunk by chunk
+	uint8_t check[1 << 16];
+	auto check_chunk = [&](const uint8_t *data, size_t size) {
+		while(size > 0) {
+			size_t part = fread(check, 1, std::min(size, sizeof(check)), check_file);
+			if(part == 0 || memcmp(check, data, part) != 0) {
+				corrupted = true;
+				return false;
+			}
+			data += part;
+			size -= part;
+			decompressed_size += part;
+		}
+		return true;
+	};
+
+	auto pass_chunk = [&](const uint8_t *data, size_t size) {
+		compressed_size += size;
+		return compressor.feedDecompress(data, size);
+	};
+
+	bool ok = compressor.beginCompress(pass_chunk) && compressor.beginDecompress(check_chunk);
+	{
+		ScopeTimer timer("Stream time");
+		uint8_t chunk[100000];
+		size_t size;
+		while(ok && (size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+			data_size += size;
+			ok = compressor.feedCompress(chunk, size);
+		}
+		ok = compressor.endCompress() && ok;
+		ok = compressor.endDecompress() && ok;
+	}
+
+	fclose(file);
+	fclose(check_file);
+
+	if(!ok) {
+		std::cerr << "stream failed." << std::endl;
+	}
+
+	std::cout << "Source data size: " << data_size << std::endl;
+	std::cout << "Compressed data size: " << compressed_size << std::endl;
+	std::cout << "Ratio: " << float(data_size) / compressed_size << std::endl;
+	std::cout << "Uncompressed data size: " << decompressed_size << std::endl;
+	std::cout << "File: " << filepath << std::endl;
+
+	if (corrupted || data_size != decompressed_size) {
+		std::cerr << "Data corruption." << std::endl;
+	}
+}
+
+void test_range_file(const char *filepath, CompressorParallel &compressor) {
+
 	FILE *file = fopen(filepath, "rb");
 	if(!file) {
 		return;
 	}
 
 	fseek(file, 0, SEEK_END);
-	auto size  = ftell(file);
+	size_t size = ftell(file);
 	fseek(file, 0, SEEK_SET);
 
-	uint8_t *data = new uint8_t[size];
-	fread(data, 1, size, file);
+	std::vector<uint8_t> data(size);
+	fread(data.data(), 1, size, file);
 	fclose(file);
 
-	test_compress_data(data, size, compressor);
+	// nothing to read from an empty file
+	if(size == 0) {
+		return;
+	}
+
+	std::cout << "--------------------------------------------------------------------------------" << std::endl;
+	std::cout << "Range reads: " << compressor.getTypeName() << std::endl;
+
+	std::vector<uint8_t> compressed(compressor.compressBound(size));
+	size_t compressed_size;
+	size_t data_size = 0;
+	if(!compressor.compress(data.data(), size, compressed.data(), compressed.size(), compressed_size)
+		|| !CompressorParallel::frameDataSize(compressed.data(), compressed_size, data_size)
+		|| data_size != size) {
+		std::cerr << "compress failed." << std::endl;
+		return;
+	}
+
+	// a few kilobytes here and there, across block edges too
+	std::vector<uint8_t> range;
+	const int NUM_READS = 64;
+	uint64_t seed = 88172645463325252ull;
+	{
+		ScopeTimer timer("Range time");
+		for(int i = 0; i < NUM_READS; ++i) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			size_t offset = seed % size;
+			size_t length = std::min<size_t>(size - offset, 1 + (seed >> 40) % 8192);
+			range.resize(length);
+			if(!compressor.decompressRange(compressed.data(), compressed_size, offset, length,
+				range.data()) || memcmp(range.data(), data.data() + offset, length) != 0) {
+				std::cerr << "Range read failed." << std::endl;
+				return;
+			}
+		}
+	}
+
+	std::cout << "Source data size: " << size << std::endl;
+	std::cout << "File: " << filepath << std::endl;
+}
+
+void test_batch_file(const char *filepath, Compressor &compressor, ThreadPool &pool) {
+
+	MappedFile file;
+	if(!file.openRead(filepath) || file.size() == 0) {
+		return;
+	}
+
+	std::cout << "--------------------------------------------------------------------------------" << std::endl;
+	std::cout << "Batch compressor: " << compressor.getTypeName() << std::endl;
+
+	// messages of 200 bytes to 4 KB from the first megabyte
+	const size_t size = std::min<size_t>(file.size(), 1 << 20);
+	std::vector<CompressorBatchItem> items;
+	std::vector<size_t> offsets;
+	uint64_t seed = 88172645463325252ull;
+	for(size_t offset = 0; offset < size;) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		CompressorBatchItem item;
+		item.data = file.data() + offset;
+		item.data_size = std::min<size_t>(size - offset, 200 + seed % 3897);
+		item.out_data_size = compressor.compressBound(item.data_size);
+		items.push_back(item);
+		offsets.push_back(offsets.empty() ? 0 : offsets.back() + items[items.size() - 2].out_data_size);
+		offset += item.data_size;
+	}
+
+	std::vector<uint8_t> compressed(offsets.back() + items.back().out_data_size);
+	for(size_t i = 0; i < items.size(); ++i) items[i].out_data = compressed.data() + offsets[i];
+
+	bool ok;
+	{
+		ScopeTimer timer("Batch compress time");
+		ok = compressor.compressBatch(items.data(), items.size(), &pool);
+	}
+
+	// the same bytes as one call per message
+	size_t compressed_size = 0;
+	std::vector<uint8_t> single(compressor.compressBound(4096));
+	for(const CompressorBatchItem &item : items) {
+		size_t single_size;
+		ok = ok && compressor.compress(item.data, item.data_size, single.data(), single.size(),
+			single_size) && single_size == item.result_size
+			&& memcmp(single.data(), item.out_data, single_size) == 0;
+		compressed_size += item.result_size;
+	}
+	if(!ok) {
+		std::cerr << "batch compress failed." << std::endl;
+		return;
+	}
+
+	std::vector<uint8_t> decompressed(size);
+	std::vector<CompressorBatchItem> compressed_items(items.size());
+	for(size_t i = 0, offset = 0; i < items.size(); offset += items[i++].data_size) {
+		compressed_items[i].data = items[i].out_data;
+		compressed_items[i].data_size = items[i].result_size;
+		compressed_items[i].out_data = decompressed.data() + offset;
+		compressed_items[i].out_data_size = items[i].data_size;
+	}
+	{
+		ScopeTimer timer("Batch decompress time");
+		ok = compressor.decompressBatch(compressed_items.data(), compressed_items.size(), &pool);
+	}
+	for(size_t i = 0; i < items.size(); ++i) {
+		ok = ok && compressed_items[i].result_size == items[i].data_size;
+	}
+
+	std::cout << "Messages: " << items.size() << std::endl;
+	std::cout << "Source data size: " << size << std::endl;
+	std::cout << "Compressed data size: " << compressed_size << std::endl;
 	std::cout << "File: " << filepath << std::endl;
-	delete[] data;
+
+	if(!ok || memcmp(decompressed.data(), file.data(), size) != 0) {
+		std::cerr << "Data corruption." << std::endl;
+	}
+}
+
+void test_dictionary_file(const char *filepath, Compressor &compressor, ThreadPool &pool) {
+
+	MappedFile file;
+	if(!file.openRead(filepath) || file.size() < 2) {
+		return;
+	}
+
+	// messages of 1 KB from the first two megabytes, the first half trains
+	const size_t message_size = 1 << 10;
+	const size_t size = std::min<size_t>(file.size(), 2 << 20);
+	std::vector<Dictionary::Sample> messages;
+	for(size_t offset = 0; offset < size; offset += message_size) {
+		messages.push_back({file.data() + offset, std::min(message_size, size - offset)});
+	}
+	const size_t num_samples = messages.size() / 2;
+	std::vector<Dictionary::Sample> samples(messages.begin(), messages.begin() + num_samples);
+	std::shared_ptr<Dictionary> dictionary = Dictionary::train(7, samples);
+
+	std::unique_ptr<Compressor> instance = compressor.clone();
+	if(!instance->setDictionary(dictionary)) {
+		return;
+	}
+
+	std::cout << "--------------------------------------------------------------------------------" << std::endl;
+	std::cout << "Dictionary compressor: " << compressor.getTypeName() << std::endl;
+
+	std::unique_ptr<Compressor> plain = compressor.clone();
+	std::vector<uint8_t> compressed(instance->compressBound(message_size));
+	std::vector<uint8_t> decompressed(message_size);
+	bool ok = true;
+	size_t source_size = 0;
+	size_t plain_size = 0;
+	size_t dictionary_size = 0;
+	for(size_t i = num_samples; i < messages.size() && ok; ++i) {
+		const Dictionary::Sample &message = messages[i];
+		size_t compressed_size;
+		size_t decompressed_size;
+		ok = plain->compress(message.data, message.size, compressed.data(), compressed.size(),
+			compressed_size);
+		plain_size += compressed_size;
+
+		ok = ok && instance->compress(message.data, message.size, compressed.data(),
+			compressed.size(), compressed_size) && instance->decompress(compressed.data(),
+			compressed_size, decompressed.data(), message.size, decompressed_size)
+			&& decompressed_size == message.size
+			&& memcmp(decompressed.data(), message.data, message.size) == 0;
+		source_size += message.size;
+		dictionary_size += compressed_size;
+	}
+
+	// a code that leaves out a symbol of the message is refused, or not used for it
+	uint8_t partial_lengths[huffman::NumSymbols];
+	memcpy(partial_lengths, dictionary->getCodeLengths(), sizeof(partial_lengths));
+	partial_lengths[messages.back().data[0]] = 0;
+	std::unique_ptr<Compressor> partial = compressor.clone();
+	if(partial->setDictionary(std::make_shared<Dictionary>(dictionary->getId(),
+		std::vector<uint8_t>(), partial_lengths))) {
+		size_t compressed_size;
+		size_t decompressed_size;
+		if(!partial->compress(messages.back().data, messages.back().size, compressed.data(),
+			compressed.size(), compressed_size) || !partial->decompress(compressed.data(),
+			compressed_size, decompressed.data(), messages.back().size, decompressed_size)
+			|| decompressed_size != messages.back().size
+			|| memcmp(decompressed.data(), messages.back().data, messages.back().size) != 0) {
+			std::cerr << "Data corruption with a partial dictionary code." << std::endl;
+		}
+	}
+
+	// messages of another dictionary, or of none, are refused
+	std::unique_ptr<Compressor> other = compressor.clone();
+	other->setDictionary(std::make_shared<Dictionary>(dictionary->getId() + 1,
+		std::vector<uint8_t>(dictionary->getContent(),
+			dictionary->getContent() + dictionary->getContentSize()),
+		dictionary->getCodeLengths()));
+	size_t compressed_size;
+	size_t decompressed_size;
+	instance->compress(messages.back().data, messages.back().size, compressed.data(),
+		compressed.size(), compressed_size);
+	if(other->decompress(compressed.data(), compressed_size, decompressed.data(),
+		messages.back().size, decompressed_size)) {
+		std::cerr << "message of another dictionary accepted." << std::endl;
+	}
+
+	// the batch calls use the dictionary too
+	std::vector<CompressorBatchItem> items(messages.size() - num_samples);
+	std::vector<uint8_t> batch_compressed(items.size() * compressed.size());
+	size_t batch_size = 0;
+	for(size_t i = 0; i < items.size(); ++i) {
+		items[i].data = messages[num_samples + i].data;
+		items[i].data_size = messages[num_samples + i].size;
+		items[i].out_data = batch_compressed.data() + i * compressed.size();
+		items[i].out_data_size = compressed.size();
+	}
+	ok = ok && instance->compressBatch(items.data(), items.size(), &pool);
+	for(const CompressorBatchItem &item : items) batch_size += item.result_size;
+
+	std::cout << "Dictionary content size: " << dictionary->getContentSize() << std::endl;
+	std::cout << "Messages: " << messages.size() - num_samples << std::endl;
+	std::cout << "Source data size: " << source_size << std::endl;
+	std::cout << "Compressed data size without dictionary: " << plain_size << std::endl;
+	std::cout << "Compressed data size with dictionary: " << dictionary_size << std::endl;
+	std::cout << "File: " << filepath << std::endl;
+
+	if(!ok || batch_size != dictionary_size) {
+		std::cerr << "Dictionary compress failed." << std::endl;
+	}
 }
 
 int main(int argc, char **argv) {
@@ -121,8 +539,14 @@ int main(int argc, char **argv) {
 	const char data6[] = "abacababacabc";
 	const char data7[] = "aaaaaaaaaaaaaa";
 
-	const int NUM_COMPRESSORS = 3;
-	Compressor *compressors[NUM_COMPRESSORS] = {new CompressorHuffman(), new CompressorLZ77(), new CompressorLZ78()};
+	CompressorParallel *parallel = new CompressorParallel(std::make_unique<CompressorLZ77>());
+	ThreadPool pool;
+
+	const int NUM_COMPRESSORS = 10;
+	Compressor *compressors[NUM_COMPRESSORS] = {new CompressorHuffman(), new CompressorHuffman(4),
+		new CompressorFSE(), new CompressorLZ77(), new CompressorLZ77Huffman(), new CompressorLZ78(),
+		new CompressorLZ78(CompressorLZ78::Mode::Phrase, 12),
+		new CompressorLZ78(CompressorLZ78::Mode::Lzw), new CompressorAuto(), parallel};
 	for (int i = 0; i < NUM_COMPRESSORS; ++i) {
 		test_compress_data((const uint8_t *)data0, sizeof(data0) - 1, *compressors[i]);
 	}
@@ -149,10 +573,24 @@ int main(int argc, char **argv) {
 		test_compress_data((const uint8_t *)data7, sizeof(data7) - 1, *compressors[i]);
 	}
 
+	// a fresh instance, then one that has just compressed skewed data
+	std::vector<uint8_t> skewed(4096, 'y');
+	for (size_t k = 0; k < skewed.size(); k += 7) skewed[k] = static_cast<uint8_t>('a' + k % 5);
+	for (int i = 0; i < NUM_COMPRESSORS; ++i) {
+		std::unique_ptr<Compressor> fresh = compressors[i]->clone();
+		test_deterministic((const uint8_t *)data0, sizeof(data0) - 1, skewed.data(), skewed.size(),
+			*fresh);
+	}
+
 	for (int j = 1; j < argc; ++j) {
 		for (int i = 0; i < NUM_COMPRESSORS; ++i) {
 			test_compress_file(argv[j], *compressors[i]);
+			test_stream_file(argv[j], *compressors[i]);
+			test_mapped_file(argv[j], *compressors[i]);
+			test_batch_file(argv[j], *compressors[i], pool);
+			test_dictionary_file(argv[j], *compressors[i], pool);
 		}
+		test_range_file(argv[j], *parallel);
 	}
 	for (int i = 0; i < NUM_COMPRESSORS; ++i) {
 		delete compressors[i];
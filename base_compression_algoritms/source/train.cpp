@@ -0,0 +1,104 @@
+#include "Dictionary.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// trains a dictionary on sample messages: every file is a sample, or with
+// --split every SIZE bytes of a file are one
+namespace
+{
+
+struct Options {
+	uint32_t id{1};
+	size_t content_size{Dictionary::DefaultContentSize};
+	size_t split{0};
+	std::string output;
+	std::vector<std::string> paths;
+};
+
+// files are taken as they are, directories for the files directly in them
+std::vector<std::string> collectFiles(const std::vector<std::string> &paths) {
+	std::vector<std::string> files;
+	for(const std::string &path : paths) {
+		std::error_code error;
+		if(std::filesystem::is_directory(path, error)) {
+			std::vector<std::string> directory;
+			for(const auto &entry : std::filesystem::directory_iterator(path, error)) {
+				if(entry.is_regular_file(error)) directory.push_back(entry.path().string());
+			}
+			std::sort(directory.begin(), directory.end());
+			files.insert(files.end(), directory.begin(), directory.end());
+		} else {
+			files.push_back(path);
+		}
+	}
+	return files;
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+	for(int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if(arg == "--id" && i + 1 < argc) {
+			options.id = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		} else if(arg == "--size" && i + 1 < argc) {
+			options.content_size = std::min<size_t>(Dictionary::MaxContentSize,
+				strtoul(argv[++i], nullptr, 10));
+		} else if(arg == "--split" && i + 1 < argc) {
+			options.split = strtoul(argv[++i], nullptr, 10);
+		} else if(arg == "-o" && i + 1 < argc) {
+			options.output = argv[++i];
+		} else if(arg.size() > 1 && arg[0] == '-') {
+			return false;
+		} else {
+			options.paths.push_back(arg);
+		}
+	}
+	return !options.paths.empty() && !options.output.empty();
+}
+
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if(!parseOptions(argc, argv, options)) {
+		fprintf(stderr, "usage: %s [--id N] [--size BYTES] [--split SIZE] -o DICTIONARY "
+			"FILE_OR_DIRECTORY...\n", argv[0]);
+		return 2;
+	}
+
+	// the files stay mapped while the samples point into them
+	std::vector<std::unique_ptr<MappedFile>> files;
+	std::vector<Dictionary::Sample> samples;
+	size_t total = 0;
+	for(const std::string &path : collectFiles(options.paths)) {
+		files.push_back(std::make_unique<MappedFile>());
+		MappedFile &file = *files.back();
+		if(!file.openRead(path.c_str())) {
+			fprintf(stderr, "can not read %s\n", path.c_str());
+			return 1;
+		}
+
+		const size_t split = options.split != 0 ? options.split : std::max<size_t>(file.size(), 1);
+		for(size_t offset = 0; offset < file.size(); offset += split) {
+			samples.push_back({file.data() + offset, std::min(split, file.size() - offset)});
+		}
+		total += file.size();
+	}
+
+	std::shared_ptr<Dictionary> dictionary = Dictionary::train(options.id, samples,
+		options.content_size);
+	if(!dictionary->saveFile(options.output.c_str())) {
+		fprintf(stderr, "can not write %s\n", options.output.c_str());
+		return 1;
+	}
+
+	printf("%zu samples, %zu bytes -> %s: id %u, %zu bytes of content\n", samples.size(), total,
+		options.output.c_str(), dictionary->getId(), dictionary->getContentSize());
+	return 0;
+}